@@ -23,23 +23,79 @@ SOFTWARE.
 #include "config.h"
 
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "call.h"
+#include "const.h"
+#include "util.h"
+
+/*
+ * Every JAL pushes a frame holding the return address and the caller's frame
+ * pointer; the callee's frame starts where the caller's local slots end. ENT
+ * gives the current frame its local slots and RTN releases them. Frames and
+ * slots grow on demand, so recursion is only limited by CSTKMAX and LOCALMAX.
+ */
 
 size_t call_return(call_stk_t *call_stack) {
 	if (call_stack->sp == 0) {
 		return 0;
 	}
 	call_stack->sp--;
-	return call_stack->mem[call_stack->sp];
+	call_stack->lp = call_stack->fp;
+	call_stack->fp = call_stack->frames[call_stack->sp].fp;
+	return call_stack->frames[call_stack->sp].ret;
 }
 
-void call_link(call_stk_t *call_stack, size_t c) {
-	if (call_stack->sp + 1 >= CSTKSZ) {
-		return;
+/* push a frame returning to c, returns -1 if the call stack is full */
+int call_link(call_stk_t *call_stack, size_t c) {
+	if (call_stack->sp == call_stack->cap && (call_stack->sp >= CSTKMAX ||
+			grow((void **) &call_stack->frames, &call_stack->cap, call_stack->sp, sizeof(frame_t)) == -1)) {
+		return -1;
 	}
 
-	call_stack->mem[call_stack->sp] = c;
+	call_stack->frames[call_stack->sp].ret = c;
+	call_stack->frames[call_stack->sp].fp = call_stack->fp;
+	call_stack->fp = call_stack->lp;
 	call_stack->sp++;
+	return 0;
+}
+
+/* give the current frame n zeroed local slots, returns -1 if there's no room */
+int call_enter(call_stk_t *call_stack, size_t n) {
+	size_t lp = call_stack->fp + n;
+
+	if (n > LOCALMAX - call_stack->fp) {
+		return -1;
+	}
+	while (lp > call_stack->lcap) {
+		if (grow((void **) &call_stack->locals, &call_stack->lcap, call_stack->lcap, sizeof(cell_t)) == -1) {
+			return -1;
+		}
+	}
+
+	memset(&call_stack->locals[call_stack->fp], '\0', n * sizeof(cell_t));
+	call_stack->lp = lp;
+	return 0;
 }
 
+/* local slot n of the current frame, NULL if the frame has no such slot */
+cell_t *call_local(call_stk_t *call_stack, size_t n) {
+	if (n >= call_stack->lp - call_stack->fp) {
+		return NULL;
+	}
+	return &call_stack->locals[call_stack->fp + n];
+}
+
+/* empty the call stack, keeping its memory for reuse */
+void call_reset(call_stk_t *call_stack) {
+	call_stack->sp = 0;
+	call_stack->fp = 0;
+	call_stack->lp = 0;
+}
+
+void call_free(call_stk_t *call_stack) {
+	free(call_stack->frames);
+	free(call_stack->locals);
+	memset(call_stack, '\0', sizeof(call_stk_t));
+}
@@ -27,7 +27,11 @@ SOFTWARE.
 
 #include "types.h"
 
-void call_link(call_stk_t *call_stack, size_t c);
+int call_link(call_stk_t *call_stack, size_t c);
 size_t call_return(call_stk_t *call_stack);
+int call_enter(call_stk_t *call_stack, size_t n);
+cell_t *call_local(call_stk_t *call_stack, size_t n);
+void call_reset(call_stk_t *call_stack);
+void call_free(call_stk_t *call_stack);
 
 #endif
@@ -0,0 +1,176 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "const.h"
+#include "util.h"
+
+/* client for tclang --serve, see server.c for the protocol */
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-s SOCKET] FILE\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/* returns -1 and sets errno on error */
+static int writeall(int fd, const char *buf, size_t len) {
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+/* read one line of the handshake, a byte at a time so nothing after it is consumed */
+static void readline(int fd, char *line, size_t size) {
+	size_t i = 0;
+	char c;
+
+	while (i + 1 < size && read(fd, &c, 1) == 1 && c != '\n') {
+		line[i++] = c;
+	}
+	line[i] = '\0';
+}
+
+int main(int argc, char *argv[]) {
+
+	struct sockaddr_un addr;
+	struct pollfd fds[2];
+	char *path, *text, line[LNLEN], buf[INBUFSZ];
+	size_t len;
+	ssize_t n;
+	FILE *in;
+	int sock, c;
+
+	path = getenv("TCLANG_SOCKET");
+	if (path == NULL) {
+		path = SOCKPATH;
+	}
+
+	while ((c = getopt(argc, argv, "s:")) != -1) {
+		switch (c) {
+			case 's':
+				path = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+	}
+
+	/* the program may end before reading all of standard input */
+	signal(SIGPIPE, SIG_IGN);
+
+	in = fopen(argv[optind], "r");
+	if (in == NULL || (text = slurp(in, &len)) == NULL) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	fclose(in);
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	dprintf(sock, "tclang %lu\n", len);
+	if (writeall(sock, text, len) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	readline(sock, line, sizeof(line));
+	free(text);
+	if (strcmp(line, "ok") != 0) {
+		fprintf(stderr, "%s: %s\n", path, line[0] ? line : "connection closed");
+		exit(EXIT_FAILURE);
+	}
+
+	/* copy standard input to the program and its output back */
+	fds[0].fd = STDIN_FILENO;
+	fds[0].events = POLLIN;
+	fds[1].fd = sock;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+		if (fds[1].revents) {
+			n = read(sock, buf, sizeof(buf));
+			if (n <= 0) {
+				break; /* program ended */
+			}
+			if (writeall(STDOUT_FILENO, buf, (size_t) n) == -1) {
+				perror("write");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (fds[0].revents) {
+			n = read(STDIN_FILENO, buf, sizeof(buf));
+			if (n <= 0) {
+				shutdown(sock, SHUT_WR);
+				fds[0].fd = -1; /* stop polling it */
+			} else if (writeall(sock, buf, (size_t) n) == -1) {
+				if (errno != EPIPE) {
+					perror(path);
+					exit(EXIT_FAILURE);
+				}
+				/* the program stopped reading, keep reading its output */
+				fds[0].fd = -1;
+			}
+		}
+	}
+
+	close(sock);
+	exit(EXIT_SUCCESS);
+}
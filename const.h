@@ -23,25 +23,105 @@ SOFTWARE.
 #ifndef __CONST_H
 #define __CONST_H
 
-/* number of labels */
-#define SYMSZ (1024)
-
 /* number of memory cells in main memory */
 #define MEMSZ (32768)
 
+/* number of memory cells in a page, for tracking writes to main memory */
+#define PAGESZ (1024)
+
 /* number of memory cells in stack */
 #define STKSZ (8192)
 
-/* number of memory cells in call stack */
-#define CSTKSZ (512)
+/* most frames on a call stack, it grows as needed up to this */
+#define CSTKMAX (1024 * 1024)
+
+/* most local slots in all the frames of a call stack */
+#define LOCALMAX (16 * 1024 * 1024)
 
 /* length of line buffer (lines must be 127 chars or less */
 #define LNLEN (128)
 
-/* max number of lines */
-#define LNMAX (8192) 
+/* returned by symfind() for an undefined label */
+#define NOSYM ((size_t) -1)
+
+/* least source text worth handing to another loader thread */
+#define CHUNKMIN (256 * 1024)
 
 /* length of labels */
 #define LBLLN (8)
 
+/* kinds of operands */
+#define ARG_NONE   (0)
+#define ARG_NUMBER (1)
+#define ARG_LABEL  (2)
+#define ARG_STRING (3)
+#define ARG_TABLE  (4)
+#define ARG_ADDRESS (5)
+
+/* number of tasks (green threads) in a vm */
+#define NTASKS (16)
+
+/* task states */
+#define TASK_FREE  (0)	/* slot unused */
+#define TASK_READY (1)	/* runnable */
+#define TASK_JOIN  (2)	/* waiting for another task to end */
+#define TASK_INPUT (3)	/* waiting for standard input */
+#define TASK_DONE  (4)	/* ended, waiting to be joined */
+
+/* max number of worker threads started by one FRK */
+#define NWORKERS (256)
+
+/* size of the standard input buffer */
+#define INBUFSZ (4096)
+
+/* most opcodes the stats segment has room for */
+#define MAXOPS (64)
+
+/* identifies a stats segment and its layout */
+#define STATMAGIC (0x54435354)
+#define STATVER (1)
+
+/* instructions between updates of the stats segment (power of 2) */
+#define STATBATCH (4096)
+
+/* line of an instruction that isn't in the source */
+#define NOLINE ((size_t) -1)
+
+/* version of the profile file format */
+#define PROFVER (1)
+
+/* largest sub-routine body (without RTN) inlined by --profile-in */
+#define INLINEMAX (8)
+
+/* a call is hot if it ran at least 1/HOTFRAC as often as the hottest line */
+#define HOTFRAC (100)
+
+/* memory cells per --heatmap block, one 64 byte cache line */
+#define HEATBLK (16)
+
+/* --heatmap blocks drawn per row */
+#define HEATROW (64)
+
+/* --heatmap shades, from untouched to hottest */
+#define HEATSHADE " .:-=+*#%@"
+
+/* kinds of memory access counted by --heatmap */
+#define HEAT_READ  (1)
+#define HEAT_WRITE (2)
+
+/* share of a line's accesses one stride apart for it to count as strided */
+#define STRIDEPCT (90)
+
+/* default socket for --serve */
+#define SOCKPATH "/tmp/tclang.sock"
+
+/* number of warm vms (and concurrent requests) in server mode */
+#define POOLSZ (16)
+
+/* number of decoded programs cached in server mode */
+#define CACHESZ (64)
+
+/* largest program text accepted in server mode */
+#define PROGMAX (64 * 1024 * 1024)
+
 #endif
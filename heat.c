@@ -0,0 +1,299 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "heat.h"
+#include "opcodes.h"
+#include "stack.h"
+#include "types.h"
+
+/*
+ * Memory access heatmap. With --heatmap the memory opcodes of the program are
+ * swapped for versions that count a read or write of their cell and note, for
+ * their line, the distance from the line's previous access. A line that keeps
+ * the same distance walks memory with a fixed stride, anything else is random.
+ * The report draws the counts one cache line sized block per character; the
+ * CSV lists the hot cells. Without --heatmap nothing is counted or checked.
+ */
+
+/* heat being sorted by hotter() */
+static heat_t *sorting;
+
+/* make room for the access patterns of n lines, returns -1 if out of memory */
+int heat_init(heat_t *heat, size_t n) {
+	heat_free(heat);
+	heat->lines = calloc(n + 1, sizeof(access_t));
+	if (heat->lines == NULL) {
+		return -1;
+	}
+	heat->n = n;
+	return 0;
+}
+
+void heat_free(heat_t *heat) {
+	free(heat->lines);
+	memset(heat, '\0', sizeof(heat_t));
+}
+
+/* count an access to memory at addr by the instruction being executed */
+static void touch(vm_t *vm, size_t addr, int how) {
+	heat_t *heat = vm->heat;
+	size_t line = vm->insn->line;
+	ptrdiff_t stride;
+	access_t *a;
+	uint64_t n;
+
+	if (addr >= MEMSZ) {
+		return;
+	}
+	if (how & HEAT_READ) {
+		__atomic_fetch_add(&heat->reads[addr], 1, __ATOMIC_RELAXED);
+	}
+	if (how & HEAT_WRITE) {
+		__atomic_fetch_add(&heat->writes[addr], 1, __ATOMIC_RELAXED);
+	}
+
+	if (line >= heat->n) {
+		return;
+	}
+
+	/* workers running the same line share its pattern, so it's approximate under FRK */
+	a = &heat->lines[line];
+	n = __atomic_fetch_add(&a->count, 1, __ATOMIC_RELAXED);
+	if (n == 0) {
+		__atomic_store_n(&a->lo, addr, __ATOMIC_RELAXED);
+		__atomic_store_n(&a->hi, addr, __ATOMIC_RELAXED);
+	} else {
+		stride = (ptrdiff_t) addr - (ptrdiff_t) __atomic_load_n(&a->last, __ATOMIC_RELAXED);
+		if (n > 1 && stride == __atomic_load_n(&a->stride, __ATOMIC_RELAXED)) {
+			__atomic_fetch_add(&a->strided, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&a->stride, stride, __ATOMIC_RELAXED);
+		if (addr < __atomic_load_n(&a->lo, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&a->lo, addr, __ATOMIC_RELAXED);
+		}
+		if (addr > __atomic_load_n(&a->hi, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&a->hi, addr, __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_store_n(&a->last, addr, __ATOMIC_RELAXED);
+}
+
+static void heat_afa(vm_t *vm) {
+	touch(vm, (size_t) vm->insn->arg, HEAT_READ | HEAT_WRITE);
+	op_afa(vm);
+}
+
+static void heat_cas(vm_t *vm) {
+	op_cas(vm);
+	touch(vm, (size_t) vm->insn->arg, peekstack(vm->stack) ? HEAT_READ | HEAT_WRITE : HEAT_READ);
+}
+
+static void heat_lda(vm_t *vm) {
+	touch(vm, (size_t) vm->insn->arg, HEAT_READ);
+	op_lda(vm);
+}
+
+/* the address is on the stack until the op pops it */
+static void heat_ldx(vm_t *vm) {
+	touch(vm, (size_t) ((long) peekstack(vm->stack) + vm->insn->arg), HEAT_READ);
+	op_ldx(vm);
+}
+
+static void heat_sta(vm_t *vm) {
+	touch(vm, (size_t) vm->insn->arg, HEAT_WRITE);
+	op_sta(vm);
+}
+
+static void heat_stx(vm_t *vm) {
+	touch(vm, (size_t) ((long) peekstack(vm->stack) + vm->insn->arg), HEAT_WRITE);
+	op_stx(vm);
+}
+
+/* count the memory accesses of program from now on */
+void heat_instrument(program_t *program) {
+	size_t i;
+
+	for (i = 0; i < program->ncode; i++) {
+		insn_t *insn = &program->code[i];
+		if (insn->fn == op_afa) {
+			insn->fn = heat_afa;
+		} else if (insn->fn == op_cas) {
+			insn->fn = heat_cas;
+		} else if (insn->fn == op_lda) {
+			insn->fn = heat_lda;
+		} else if (insn->fn == op_ldx) {
+			insn->fn = heat_ldx;
+		} else if (insn->fn == op_sta) {
+			insn->fn = heat_sta;
+		} else if (insn->fn == op_stx) {
+			insn->fn = heat_stx;
+		}
+	}
+}
+
+/* number of significant bits in x */
+static int bits(uint64_t x) {
+	int n = 0;
+
+	while (x != 0) {
+		x >>= 1;
+		n++;
+	}
+
+	return n;
+}
+
+/* describe the way a line walks memory */
+static void pattern(access_t *a, char *buf, size_t len) {
+	if (a->count == 1) {
+		snprintf(buf, len, "once");
+	} else if (a->lo == a->hi) {
+		snprintf(buf, len, "fixed");
+	} else if (a->count > 2 && a->strided * 100 >= (a->count - 2) * STRIDEPCT) {
+		snprintf(buf, len, "stride %ld", (long) a->stride);
+	} else {
+		snprintf(buf, len, "random");
+	}
+}
+
+int heat_report(heat_t *heat, program_t *program, const char *path) {
+	uint64_t blocks[MEMSZ / HEATBLK], reads = 0, writes = 0, max = 0;
+	size_t i, j, cells = 0, touched = 0;
+	int nshades = (int) strlen(HEATSHADE);
+	char buf[32];
+	FILE *out;
+
+	out = fopen(path, "w");
+	if (out == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	memset(blocks, '\0', sizeof(blocks));
+	for (i = 0; i < MEMSZ; i++) {
+		reads += heat->reads[i];
+		writes += heat->writes[i];
+		blocks[i / HEATBLK] += heat->reads[i] + heat->writes[i];
+		cells += heat->reads[i] + heat->writes[i] != 0;
+	}
+	for (i = 0; i < MEMSZ / HEATBLK; i++) {
+		touched += blocks[i] != 0;
+		if (blocks[i] > max) {
+			max = blocks[i];
+		}
+	}
+
+	fprintf(out, "%" PRIu64 " reads, %" PRIu64 " writes, %lu of %d cells and %lu of %d blocks touched\n",
+			reads, writes, cells, MEMSZ, touched, MEMSZ / HEATBLK);
+	fprintf(out, "one character per %d cells, \"%s\" from untouched to %" PRIu64 " accesses\n\n",
+			HEATBLK, HEATSHADE, max);
+
+	/* shades go by order of magnitude so a few hot cells don't wash out the rest */
+	for (i = 0; i < MEMSZ / HEATBLK; i += HEATROW) {
+		fprintf(out, "%6lu |", i * HEATBLK);
+		for (j = i; j < i + HEATROW; j++) {
+			int shade = 0;
+			if (blocks[j] != 0) {
+				shade = bits(blocks[j]) * (nshades - 1) / bits(max);
+				shade = shade < 1 ? 1 : shade;
+			}
+			fputc(HEATSHADE[shade], out);
+		}
+		fprintf(out, "|\n");
+	}
+
+	fprintf(out, "\n%6s %12s %-14s %-13s %s\n", "LINE", "ACCESSES", "PATTERN", "ADDRESSES", "SOURCE");
+	for (i = 0; i < heat->n && i < program->sp; i++) {
+		access_t *a = &heat->lines[i];
+		if (a->count == 0) {
+			continue;
+		}
+		pattern(a, buf, sizeof(buf));
+		fprintf(out, "%6lu %12" PRIu64 " %-14s %5lu-%-7lu %s\n", i, a->count, buf, a->lo, a->hi, program->lines[i]);
+	}
+
+	if (fclose(out) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* qsort() order for cells, most accessed first */
+static int hotter(const void *x, const void *y) {
+	size_t a = *(const size_t *) x, b = *(const size_t *) y;
+	uint64_t ta = sorting->reads[a] + sorting->writes[a];
+	uint64_t tb = sorting->reads[b] + sorting->writes[b];
+
+	if (ta != tb) {
+		return ta > tb ? -1 : 1;
+	}
+	return a < b ? -1 : a > b;
+}
+
+int heat_csv(heat_t *heat, const char *path) {
+	size_t *cells, i, n;
+	FILE *out;
+
+	cells = malloc(MEMSZ * sizeof(size_t));
+	if (cells == NULL) {
+		perror(path);
+		return -1;
+	}
+	for (i = n = 0; i < MEMSZ; i++) {
+		if (heat->reads[i] + heat->writes[i] != 0) {
+			cells[n++] = i;
+		}
+	}
+	sorting = heat;
+	qsort(cells, n, sizeof(size_t), hotter);
+
+	out = fopen(path, "w");
+	if (out == NULL) {
+		perror(path);
+		free(cells);
+		return -1;
+	}
+
+	fprintf(out, "address,block,reads,writes\n");
+	for (i = 0; i < n; i++) {
+		fprintf(out, "%lu,%lu,%" PRIu64 ",%" PRIu64 "\n", cells[i], cells[i] / HEATBLK,
+				heat->reads[cells[i]], heat->writes[cells[i]]);
+	}
+	free(cells);
+
+	if (fclose(out) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "types.h"
+
+void input_init(input_t *in, int fd) {
+	in->fd = fd;
+	in->pos = in->len = 0;
+	in->total = 0;
+	in->eof = fd < 0;
+}
+
+static void input_fill(input_t *in) {
+	ssize_t n = 0;
+
+	while (in->fd >= 0) {
+		n = read(in->fd, in->buf, INBUFSZ);
+		if (n != -1 || errno != EINTR) {
+			break;
+		}
+	}
+
+	if (n <= 0) {
+		in->eof = 1;
+		n = 0;
+	}
+	in->pos = 0;
+	in->len = (size_t) n;
+	in->total += (uint64_t) n;
+}
+
+/* make the len bytes at rec all of the input */
+void input_record(input_t *in, const char *rec, size_t len) {
+	if (len > INBUFSZ) {
+		len = INBUFSZ;
+	}
+	memcpy(in->buf, rec, len);
+	in->pos = 0;
+	in->len = len;
+	in->total += len;
+	in->fd = -1;
+	in->eof = 0;
+}
+
+/* returns non-zero when reading fd would not block */
+static int readable(input_t *in) {
+	struct pollfd pfd;
+
+	pfd.fd = in->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/* returns non-zero when input_getc() would not block */
+int input_ready(input_t *in) {
+	if (in->pos < in->len || in->eof) {
+		return 1;
+	}
+
+	return readable(in);
+}
+
+/* returns non-zero when input_gets() would not block, buffering what it can meanwhile */
+int input_line_ready(input_t *in) {
+	ssize_t n;
+
+	for (;;) {
+		if (in->eof || in->fd < 0 || memchr(in->buf + in->pos, '\n', in->len - in->pos) != NULL) {
+			return 1;
+		}
+		if (in->len - in->pos == INBUFSZ) {
+			return 1; /* no room to wait for the rest */
+		}
+		if (!readable(in)) {
+			return 0;
+		}
+
+		/* keep the partial line and append what's there */
+		memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+		in->len -= in->pos;
+		in->pos = 0;
+		do {
+			n = read(in->fd, in->buf + in->len, INBUFSZ - in->len);
+		} while (n == -1 && errno == EINTR);
+		if (n <= 0) {
+			in->eof = 1;
+			n = 0;
+		}
+		in->len += (size_t) n;
+		in->total += (uint64_t) n;
+	}
+}
+
+int input_getc(input_t *in) {
+	if (in->pos >= in->len && !in->eof) {
+		input_fill(in);
+	}
+	if (in->pos >= in->len) {
+		return EOF;
+	}
+	return (unsigned char) in->buf[in->pos++];
+}
+
+/* like fgets(3) */
+char *input_gets(input_t *in, char *line, size_t size) {
+	size_t i = 0;
+	int c = EOF;
+
+	while (i + 1 < size && c != '\n' && (c = input_getc(in)) != EOF) {
+		line[i++] = (char) c;
+	}
+	line[i] = '\0';
+
+	return i == 0 ? NULL : line;
+}
+
+/* like fread(3), returns the number of bytes read */
+size_t input_read(input_t *in, char *buf, size_t size) {
+	size_t i = 0;
+	int c;
+
+	while (i < size && (c = input_getc(in)) != EOF) {
+		buf[i++] = (char) c;
+	}
+
+	return i;
+}
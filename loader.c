@@ -0,0 +1,357 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "const.h"
+#include "loader.h"
+#include "symtab.h"
+#include "types.h"
+#include "util.h"
+#include "vm.h"
+
+/*
+ * The source is cut into line aligned chunks, one per thread. Each thread
+ * splits and decodes its chunk on its own, numbering lines, instructions and
+ * labels from zero. Labels are then defined in source order, so the first
+ * definition still wins, and the threads copy their chunks into place while
+ * resolving label operands. A program loads the same whatever the number of
+ * threads.
+ */
+
+/* copy the chunk into the program text, split it into lines and decode them */
+static void *split(void *arg) {
+	chunk_t *chunk = arg;
+	char *line, *end, *nl;
+
+	memcpy(chunk->text, chunk->src, chunk->len);
+
+	line = chunk->text;
+	end = chunk->text + chunk->len;
+	while (line < end) {
+		nl = memchr(line, '\n', (size_t) (end - line));
+		if (nl == NULL) {
+			nl = end; /* last line has no newline, the text ends in '\0' */
+		}
+		*nl = '\0';
+		if (nl > line && nl[-1] == '\r') {
+			nl[-1] = '\0';
+		}
+
+		if (grow((void **) &chunk->lines, &chunk->linecap, chunk->nlines, sizeof(char *)) == -1) {
+			chunk->error = 1;
+			break;
+		}
+		chunk->lines[chunk->nlines] = line;
+		if (decode(chunk, chunk->nlines++) == -1) {
+			chunk->error = 1;
+			break;
+		}
+
+		line = nl + 1;
+	}
+
+	return NULL;
+}
+
+/* operand of a line, empty if it has none */
+char *operand(char *line) {
+	return strlen(line) > 12 ? line + 12 : "";
+}
+
+/* copy the label at s up to a comma, returns what follows the comma or NULL */
+static char *nextlabel(char *s, char label[LBLLN + 1]) {
+	size_t i;
+
+	for (i = 0; s[i] != ',' && s[i] != '\0'; i++) {
+		if (i < LBLLN) {
+			label[i] = s[i];
+		}
+	}
+	label[i < LBLLN ? i : LBLLN] = '\0'; /* too long for any label, won't be found */
+
+	return s[i] == ',' ? s + i + 1 : NULL;
+}
+
+/* resolve the labels listed by a TBL directive */
+static int resolve(program_t *program, jtab_t *table) {
+	char label[LBLLN + 1], *s = operand(program->lines[table->line]);
+	size_t n;
+
+	table->n = 0;
+	if (*s == '\0') {
+		return 0;
+	}
+
+	for (n = 1; (s = strchr(s, ',')) != NULL; s++) {
+		n++;
+	}
+	table->targets = malloc(n * sizeof(size_t));
+	if (table->targets == NULL) {
+		return -1;
+	}
+
+	s = operand(program->lines[table->line]);
+	while (s != NULL) {
+		s = nextlabel(s, label);
+		table->targets[table->n++] = symfind(&program->symtab, label);
+	}
+
+	return 0;
+}
+
+/* move the chunk into the program and resolve label operands */
+static void *place(void *arg) {
+	chunk_t *chunk = arg;
+	program_t *program = chunk->program;
+	char label[LBLLN + 1], *s;
+	size_t i;
+
+	if (chunk->nlines > 0) {
+		memcpy(&program->lines[chunk->line0], chunk->lines, chunk->nlines * sizeof(char *));
+	}
+	for (i = 0; i < chunk->ntables; i++) {
+		program->tables[chunk->tbl0 + i].line = chunk->line0 + chunk->tables[i].pc;
+		if (resolve(program, &program->tables[chunk->tbl0 + i]) == -1) {
+			chunk->error = 1;
+		}
+	}
+
+	for (i = 0; i < chunk->ncode; i++) {
+		insn_t *insn = &program->code[chunk->pc0 + i];
+		*insn = chunk->code[i];
+		insn->line += chunk->line0;
+		if (oparg(insn) == ARG_LABEL) {
+			insn->target = symfind(&program->symtab, operand(program->lines[insn->line]));
+		} else if (oparg(insn) == ARG_TABLE) {
+			/* TABLE or TABLE,DEFAULT, without a default fall through */
+			s = nextlabel(operand(program->lines[insn->line]), label);
+			insn->target = chunk->pc0 + i + 1;
+			insn->arg = (cell_t) symfind(&program->tabsyms, label);
+			if (s != NULL) {
+				nextlabel(s, label);
+				insn->target = symfind(&program->symtab, label);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* run fn on every chunk, chunk 0 in this thread */
+static void each(chunk_t *chunks, size_t n, void *(*fn)(void *)) {
+	size_t i;
+
+	for (i = 1; i < n; i++) {
+		chunks[i].joinable = pthread_create(&chunks[i].thread, NULL, fn, &chunks[i]) == 0;
+		if (!chunks[i].joinable) {
+			fn(&chunks[i]);
+		}
+	}
+
+	fn(&chunks[0]);
+
+	for (i = 1; i < n; i++) {
+		if (chunks[i].joinable) {
+			pthread_join(chunks[i].thread, NULL);
+		}
+	}
+}
+
+/* load the len bytes of program text at src, returns -1 if out of memory */
+int load(program_t *program, const char *src, size_t len) {
+
+	size_t n, i, start, end, nlines, ncode, ntables;
+	chunk_t *chunks;
+	long ncpu;
+	int error = 0;
+
+	memset(program, '\0', sizeof(program_t));
+
+	/* enough chunks to keep every core busy, but not for small programs */
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	n = len / CHUNKMIN;
+	if (ncpu > 0 && n > (size_t) ncpu) {
+		n = (size_t) ncpu;
+	}
+	if (n > NWORKERS) {
+		n = NWORKERS;
+	}
+	if (n == 0) {
+		n = 1;
+	}
+
+	program->text = malloc(len + 1);
+	chunks = calloc(n, sizeof(chunk_t));
+	if (program->text == NULL || chunks == NULL) {
+		free(chunks);
+		program_free(program);
+		return -1;
+	}
+	program->text[len] = '\0';
+
+	/* cut just after a newline near each 1/n of the text */
+	for (i = start = 0; i < n; i++) {
+		end = i + 1 == n ? len : len / n * (i + 1);
+		if (end < start) {
+			end = start;
+		}
+		if (i + 1 < n) {
+			const char *nl = memchr(src + end, '\n', len - end);
+			end = nl == NULL ? len : (size_t) (nl - src) + 1;
+		}
+		chunks[i].src = src + start;
+		chunks[i].len = end - start;
+		chunks[i].text = program->text + start;
+		chunks[i].program = program;
+		start = end;
+	}
+
+	each(chunks, n, split);
+
+	/* where each chunk's lines, instructions and jump tables go, and its labels */
+	for (i = nlines = ncode = ntables = 0; i < n && !error; i++) {
+		size_t j;
+
+		error = chunks[i].error;
+		chunks[i].line0 = nlines;
+		chunks[i].pc0 = ncode;
+		chunks[i].tbl0 = ntables;
+		nlines += chunks[i].nlines;
+		ncode += chunks[i].ncode;
+		ntables += chunks[i].ntables;
+
+		for (j = 0; j < chunks[i].nsyms && !error; j++) {
+			error = symdef(&program->symtab, chunks[i].symbols[j].label, chunks[i].pc0 + chunks[i].symbols[j].pc) == -1;
+		}
+		for (j = 0; j < chunks[i].ntables && !error; j++) {
+			error = symdef(&program->tabsyms, chunks[i].tables[j].label, chunks[i].tbl0 + j) == -1;
+		}
+	}
+
+	if (!error) {
+		program->lines = malloc((nlines + 1) * sizeof(char *));
+		program->code = malloc((ncode + 1) * sizeof(insn_t));
+		program->tables = calloc(ntables + 1, sizeof(jtab_t));
+		error = program->lines == NULL || program->code == NULL || program->tables == NULL;
+	}
+
+	if (!error) {
+		program->sp = nlines;
+		program->ncode = ncode;
+		program->ntables = ntables;
+		each(chunks, n, place);
+		for (i = 0; i < n; i++) {
+			error |= chunks[i].error;
+		}
+	}
+
+	if (!error) {
+		/* start a MAIN */
+		program->entry = symfind(&program->symtab, "MAIN"); /* move to const.h */
+		/* if not found, start at the beginning */
+		if (program->entry == NOSYM) {
+			program->entry = 0;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		free(chunks[i].lines);
+		free(chunks[i].code);
+		free(chunks[i].symbols);
+		free(chunks[i].tables);
+	}
+	free(chunks);
+
+	if (error) {
+		program_free(program);
+		return -1;
+	}
+	return 0;
+}
+
+/* load the program in the file at path, returns -1 and sets errno on error */
+int loadfile(program_t *program, const char *path) {
+	struct stat st;
+	size_t len;
+	char *text;
+	void *map;
+	FILE *in;
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	/* map regular files, read anything else */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			close(fd);
+			rc = load(program, map, (size_t) st.st_size);
+			munmap(map, (size_t) st.st_size);
+			return rc;
+		}
+	}
+
+	in = fdopen(fd, "r");
+	if (in == NULL) {
+		close(fd);
+		return -1;
+	}
+	text = slurp(in, &len);
+	fclose(in);
+	if (text == NULL) {
+		return -1;
+	}
+
+	rc = load(program, text, len);
+	free(text);
+	return rc;
+}
+
+void program_free(program_t *program) {
+	size_t i;
+
+	free(program->text);
+	free(program->lines);
+	free(program->code);
+	free(program->inner);
+	for (i = 0; i < program->ntables; i++) {
+		free(program->tables[i].targets);
+	}
+	free(program->tables);
+	symfree(&program->symtab);
+	symfree(&program->tabsyms);
+	memset(program, '\0', sizeof(program_t));
+}
@@ -22,32 +22,162 @@ SOFTWARE.
 
 #include "config.h"
 
+#include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "heat.h"
+#include "loader.h"
+#include "pgo.h"
+#include "server.h"
+#include "stats.h"
 #include "types.h"
 #include "vm.h"
 
+static program_t program;
+static profile_t profile;
+static heat_t heat;
+static mem_t memory;
 static vm_t vm;
 
+static struct option options[] = {
+	{ "serve", required_argument, NULL, 'S' },
+	{ "timeout", required_argument, NULL, 't' },
+	{ "stats", no_argument, NULL, 's' },
+	{ "profile-in", required_argument, NULL, 'i' },
+	{ "profile-out", required_argument, NULL, 'o' },
+	{ "records", optional_argument, NULL, 'r' },
+	{ "heatmap", required_argument, NULL, 'H' },
+	{ "heatmap-csv", required_argument, NULL, 'c' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [--stats] [--profile-in PROFILE] [--profile-out PROFILE] [--records[=SIZE]]\n", prog);
+	fprintf(stderr, "       %*s [--heatmap REPORT] [--heatmap-csv CSV] FILE\n", (int) strlen(prog), "");
+	fprintf(stderr, "       %s [--stats] [--timeout SECONDS] --serve SOCKET\n", prog);
+	exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *argv[]) {
 
-	FILE *in;
+	stats_t *stats = NULL;
+	int counting = 0;
+	char *sock = NULL, *profin = NULL, *profout = NULL, *heatout = NULL, *heatcsv = NULL;
+	long recsz = -1;
+	int limit = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (c) {
+			case 'S':
+				sock = optarg;
+				break;
+			case 't':
+				limit = atoi(optarg);
+				if (limit < 0) {
+					usage(argv[0]);
+				}
+				break;
+			case 's':
+				counting = 1;
+				break;
+			case 'i':
+				profin = optarg;
+				break;
+			case 'o':
+				profout = optarg;
+				break;
+			case 'H':
+				heatout = optarg;
+				break;
+			case 'c':
+				heatcsv = optarg;
+				break;
+			case 'r':
+				recsz = optarg == NULL ? 0 : atol(optarg);
+				if (recsz < 0 || recsz > INBUFSZ || (optarg != NULL && recsz == 0)) {
+					fprintf(stderr, "%s: record size must be 1 to %d\n", argv[0], INBUFSZ);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	/* only once nothing can stop us early, or the segment would be left behind */
+	if (sock != NULL) {
+		if (counting) {
+			stats = stats_open();
+		}
+		serve(sock, stats, limit);
+		stats_close(stats);
+		exit(EXIT_FAILURE);
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+	}
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: %s FILE\n", argv[0]);
+	if (loadfile(&program, argv[optind]) == -1) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
 	}
 
-	in = fopen(argv[1], "r");
-	if (in == NULL) {
+	if (profin != NULL && profile_read(&profile, &program, profin) == 0) {
+		optimize(&program, &profile);
+	}
+
+	vm_init(&vm, &program, &memory);
+	if (profout != NULL) {
+		if (profile_init(&profile, program.sp) == -1) {
+			perror(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		vm.profile = &profile;
+	}
+	if (heatout != NULL || heatcsv != NULL) {
+		if (heat_init(&heat, program.sp) == -1) {
+			perror(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		vm.heat = &heat;
+		heat_instrument(&program);
+	}
+	if (counting) {
+		stats = stats_open();
+	}
+	if (stats != NULL) {
+		vm_stats(&vm, stats);
+	}
+	if (profout != NULL && vm_instrument(&program) == -1) {
 		perror(argv[0]);
+		stats_close(stats);
 		exit(EXIT_FAILURE);
 	}
+	if (recsz == -1) {
+		run(&vm);
+	} else {
+		run_records(&vm, (size_t) recsz);
+	}
 
-	load(&vm, in);
-	run(&vm);
+	if (profout != NULL) {
+		profile_write(&profile, &program, profout);
+	}
 
-	fclose(in);
+	if (heatout != NULL) {
+		heat_report(&heat, &program, heatout);
+	}
+	if (heatcsv != NULL) {
+		heat_csv(&heat, heatcsv);
+	}
+
+	profile_free(&profile);
+	heat_free(&heat);
+	vm_free(&vm);
+	program_free(&program);
+	stats_close(stats);
 
 	exit(EXIT_SUCCESS);
 }
-
@@ -0,0 +1,164 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "const.h"
+#include "stats.h"
+#include "types.h"
+
+/* tclang-stat - watch the stats of a tclang --stats process, like top(1) */
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-d SECONDS] [-n COUNT] PID\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static uint64_t get(uint64_t *counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void show(stats_t *stats, uint64_t *last, double elapsed, int clear) {
+	uint64_t ops[MAXOPS], insns;
+	size_t i, j, top[MAXOPS], n;
+
+	insns = get(&stats->insns);
+	n = stats->nops < MAXOPS ? stats->nops : MAXOPS;
+	for (i = 0; i < n; i++) {
+		ops[i] = get(&stats->ops[i]);
+		top[i] = i;
+	}
+
+	/* busiest opcodes first */
+	for (i = 1; i < n; i++) {
+		size_t t = top[i];
+		for (j = i; j > 0 && ops[top[j - 1]] < ops[t]; j--) {
+			top[j] = top[j - 1];
+		}
+		top[j] = t;
+	}
+
+	if (clear) {
+		printf("\033[H\033[2J");
+	}
+	printf("tclang pid %u\n\n", stats->pid);
+	printf("instructions  %20llu\n", (unsigned long long) insns);
+	printf("instructions/s%20.0f\n", elapsed > 0 ? (double) (insns - *last) / elapsed : 0.0);
+	printf("stack depth   %20llu  peak %llu\n", (unsigned long long) get(&stats->stack), (unsigned long long) get(&stats->stack_peak));
+	printf("call depth    %20llu  peak %llu\n", (unsigned long long) get(&stats->call), (unsigned long long) get(&stats->call_peak));
+	printf("output bytes  %20llu\n", (unsigned long long) get(&stats->out));
+	printf("input bytes   %20llu\n\n", (unsigned long long) get(&stats->in));
+
+	printf("op  %20s %7s\n", "count", "%");
+	for (i = 0; i < n && ops[top[i]] != 0; i++) {
+		printf("%.3s %20llu %6.2f%%\n", stats->names[top[i]], (unsigned long long) ops[top[i]],
+				100.0 * (double) ops[top[i]] / (double) (insns ? insns : 1));
+	}
+	fflush(stdout);
+
+	*last = insns;
+}
+
+int main(int argc, char *argv[]) {
+
+	stats_t *stats;
+	char name[32];
+	double delay = 1.0, then, t;
+	long count = -1;
+	uint64_t last;
+	pid_t pid;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "d:n:")) != -1) {
+		switch (c) {
+			case 'd':
+				delay = atof(optarg);
+				break;
+			case 'n':
+				count = atol(optarg);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc || delay <= 0) {
+		usage(argv[0]);
+	}
+	pid = (pid_t) atol(argv[optind]);
+
+	statname(name, (unsigned int) pid);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	stats = mmap(NULL, sizeof(stats_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	if (__atomic_load_n(&stats->magic, __ATOMIC_ACQUIRE) != STATMAGIC || stats->version != STATVER) {
+		fprintf(stderr, "%s: not a version %d tclang stats segment\n", name, STATVER);
+		exit(EXIT_FAILURE);
+	}
+
+	last = get(&stats->insns);
+	then = now();
+	while (count != 0) {
+		struct timespec ts;
+		ts.tv_sec = (time_t) delay;
+		ts.tv_nsec = (long) ((delay - (double) ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+
+		t = now();
+		show(stats, &last, t - then, isatty(STDOUT_FILENO));
+		then = t;
+
+		if (kill(pid, 0) == -1 && errno == ESRCH) {
+			break; /* it's gone */
+		}
+		if (count > 0) {
+			count--;
+		}
+	}
+
+	munmap(stats, sizeof(stats_t));
+	exit(EXIT_SUCCESS);
+}
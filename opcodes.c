@@ -28,79 +28,154 @@ SOFTWARE.
 #include <string.h>
 
 #include "call.h"
+#include "io.h"
+#include "loader.h"
 #include "opcodes.h"
+#include "par.h"
 #include "stack.h"
-#include "symtab.h"
+#include "task.h"
 #include "types.h"
 
+/* count bytes written for the stats, stop if output fails */
+static void output(vm_t *vm, int n) {
+	if (n > 0) {
+		vm->tally.out += (uint64_t) n;
+	} else if (n < 0) {
+		vm->done = 1; /* nobody is reading it any more */
+	}
+}
+
+/* report a run time error and stop the vm */
+static void fail(vm_t *vm, const char *what) {
+	fprintf(stderr, "ERROR: %s (LINE %lu)\n", what, vm->insn->line);
+	vm->done = 1;
+}
+
+/* memory cell at the address popped off the stack plus the operand, NULL if out of range */
+static cell_t *indexed(vm_t *vm) {
+	long addr = (long) popstack(vm->stack) + vm->insn->arg;
+
+	if (addr < 0 || addr >= MEMSZ) {
+		fail(vm, "BAD ADDRESS");
+		return NULL;
+	}
+	return &vm->memory->cells[addr];
+}
+
 void op_add(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) + popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) + popstack(vm->stack));
+}
+
+void op_afa(vm_t *vm) {
+	cell_t *cell = &vm->memory->cells[vm->insn->arg];
+	vm->memory->dirty[vm->insn->arg / PAGESZ] = 1;
+	pushstack(vm->stack, __atomic_fetch_add(cell, popstack(vm->stack), __ATOMIC_SEQ_CST));
 }
 
 void op_and(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) & popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) & popstack(vm->stack));
+}
+
+void op_bar(vm_t *vm) {
+	par_barrier(vm);
+}
+
+void op_bad(vm_t *vm) {
+	fail(vm, "BAD OP CODE");
+}
+
+/* stands in for an instruction whose address operand is outside of main memory */
+void op_bad_address(vm_t *vm) {
+	fail(vm, "BAD ADDRESS");
 }
 
 void op_bez(vm_t *vm) {
-	if (popstack(&vm->stack) == 0) {
-		vm->pc = symfind(&vm->symtab, vm->program.lines[vm->pc] + 12);
+	if (popstack(vm->stack) == 0) {
+		vm->pc = vm->insn->target;
 	}
 }
 
 void op_bnz(vm_t *vm) {
-	if (popstack(&vm->stack) != 0) {
-		vm->pc = symfind(&vm->symtab, vm->program.lines[vm->pc] + 12);
+	if (popstack(vm->stack) != 0) {
+		vm->pc = vm->insn->target;
 	}
 }
 
 void op_bra(vm_t *vm) {
-	vm->pc = symfind(&vm->symtab, vm->program.lines[vm->pc] + 12);
+	vm->pc = vm->insn->target;
 }
 
 void op_bls(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) << popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) << popstack(vm->stack));
 }
 
 void op_brs(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) >> popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) >> popstack(vm->stack));
+}
+
+void op_cas(vm_t *vm) {
+	cell_t *cell = &vm->memory->cells[vm->insn->arg];
+	cell_t desired = popstack(vm->stack);
+	cell_t expected = popstack(vm->stack);
+	vm->memory->dirty[vm->insn->arg / PAGESZ] = 1;
+	pushstack(vm->stack, __atomic_compare_exchange_n(cell, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
 }
 
 void op_ceq(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) == popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) == popstack(vm->stack));
 }
 
 void op_cge(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) >= popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) >= popstack(vm->stack));
 }
 
 void op_cgt(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) > popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) > popstack(vm->stack));
 }
 
 void op_cle(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) <= popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) <= popstack(vm->stack));
 }
 
 void op_clt(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) < popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) < popstack(vm->stack));
 }
 
 void op_cne(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) != popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) != popstack(vm->stack));
 }
 
 void op_dec(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) - 1);
+	pushstack(vm->stack, popstack(vm->stack) - 1);
 }
 
 void op_div(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) / popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) / popstack(vm->stack));
+}
+
+void op_drp(vm_t *vm) {
+	popstack(vm->stack);
 }
 
 void op_dup(vm_t *vm) {
-	int32_t val = popstack(&vm->stack);
-	pushstack(&vm->stack, val);
-	pushstack(&vm->stack, val);
+	int32_t val = popstack(vm->stack);
+	pushstack(vm->stack, val);
+	pushstack(vm->stack, val);
+}
+
+void op_end(vm_t *vm) {
+	task_end(vm);
+}
+
+void op_ent(vm_t *vm) {
+	if (vm->insn->arg < 0 || call_enter(vm->call_stack, (size_t) vm->insn->arg) == -1) {
+		fail(vm, "OUT OF LOCAL SLOTS");
+	}
+}
+
+void op_frk(vm_t *vm) {
+	cell_t n = popstack(vm->stack);
+	par_fork(vm, vm->insn->target, n < 0 ? 0 : (size_t) n);
 }
 
 void op_hlt(vm_t *vm) {
@@ -108,74 +183,183 @@ void op_hlt(vm_t *vm) {
 }
 
 void op_ich(vm_t *vm) {
-	pushstack(&vm->stack, getc(stdin));
+	if (task_wait_input(vm, 0)) {
+		vm->pc--; /* try again when rescheduled */
+		return;
+	}
+	pushstack(vm->stack, input_getc(&vm->in));
+	if (vm->in.eof) {
+		task_end(vm);
+	}
 }
 
 void op_inc(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) + 1);
+	pushstack(vm->stack, popstack(vm->stack) + 1);
 }
 
 void op_ini(vm_t *vm) {
 	char line[LINE_MAX], *s;
+	if (task_wait_input(vm, 1)) {
+		vm->pc--; /* try again when rescheduled */
+		return;
+	}
 	memset(line, '\0', LINE_MAX);
-	if ((s = fgets(line, LINE_MAX, stdin)) != NULL) {
-		pushstack(&vm->stack, atoi(line));
+	if ((s = input_gets(&vm->in, line, LINE_MAX)) != NULL) {
+		pushstack(vm->stack, atoi(line));
+	}
+	if (vm->in.eof) {
+		task_end(vm);
 	}
 }
 
 void op_jal(vm_t *vm) {
-	call_link(&vm->call_stack, vm->pc);
-	vm->pc = symfind(&vm->symtab, vm->program.lines[vm->pc] + 12);
+	if (call_link(vm->call_stack, vm->pc) == -1) {
+		fail(vm, "CALL STACK OVERFLOW");
+		return;
+	}
+	vm->pc = vm->insn->target;
+}
+
+void op_jnw(vm_t *vm) {
+	par_join(vm);
+}
+
+void op_jon(vm_t *vm) {
+	cell_t id = popstack(vm->stack);
+	if (task_join(vm, (size_t) id)) {
+		pushstack(vm->stack, id);
+		vm->pc--; /* try again when rescheduled */
+	}
+}
+
+void op_jtb(vm_t *vm) {
+	cell_t i = popstack(vm->stack);
+	jtab_t *table;
+
+	vm->pc = vm->insn->target; /* out of range, take the default */
+	if (vm->insn->arg >= 0) {
+		table = &vm->program->tables[vm->insn->arg];
+		if (i >= 0 && (size_t) i < table->n) {
+			vm->pc = table->targets[i];
+		}
+	}
 }
 
 void op_lda(vm_t *vm) {
-	pushstack(&vm->stack, vm->memory[atoi(vm->program.lines[vm->pc] + 12)]);
+	pushstack(vm->stack, vm->memory->cells[vm->insn->arg]);
 }
 
 void op_ldi(vm_t *vm) {
-	pushstack(&vm->stack, atoi(vm->program.lines[vm->pc] + 12));
+	pushstack(vm->stack, vm->insn->arg);
+}
+
+void op_ldl(vm_t *vm) {
+	cell_t *slot = call_local(vm->call_stack, (size_t) vm->insn->arg);
+
+	if (slot == NULL) {
+		fail(vm, "BAD LOCAL SLOT");
+		return;
+	}
+	pushstack(vm->stack, *slot);
+}
+
+void op_ldx(vm_t *vm) {
+	cell_t *cell = indexed(vm);
+
+	if (cell != NULL) {
+		pushstack(vm->stack, *cell);
+	}
 }
 
 void op_mod(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) % popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) % popstack(vm->stack));
 }
 
 void op_mul(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) * popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) * popstack(vm->stack));
 }
 
 void op_not(vm_t *vm) {
-	pushstack(&vm->stack, ~popstack(&vm->stack));
+	pushstack(vm->stack, ~popstack(vm->stack));
 }
 
 void op_oar(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) | popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) | popstack(vm->stack));
 }
 
 void op_och(vm_t *vm) {
-	fprintf(stdout, "%c", popstack(&vm->stack));
+	output(vm, fprintf(vm->out, "%c", popstack(vm->stack)));
 }
 
 void op_oti(vm_t *vm) {
-	fprintf(stdout, "%d", popstack(&vm->stack));
+	output(vm, fprintf(vm->out, "%d", popstack(vm->stack)));
 }
 
 void op_ots(vm_t *vm) {
-	fprintf(stdout, "%s\n", vm->program.lines[vm->pc] + 12);
+	output(vm, fprintf(vm->out, "%s\n", operand(vm->program->lines[vm->insn->line])));
+}
+
+void op_ovr(vm_t *vm) {
+	overstack(vm->stack);
+}
+
+void op_pik(vm_t *vm) {
+	pickstack(vm->stack, (size_t) vm->insn->arg);
+}
+
+void op_rol(vm_t *vm) {
+	rollstack(vm->stack, (size_t) vm->insn->arg);
+}
+
+void op_rot(vm_t *vm) {
+	rotstack(vm->stack);
 }
 
 void op_rtn(vm_t *vm) {
-	vm->pc = call_return(&vm->call_stack);
+	vm->pc = call_return(vm->call_stack);
+}
+
+void op_spn(vm_t *vm) {
+	size_t id = task_spawn(vm, vm->insn->target);
+	pushstack(vm->stack, id == NTASKS ? -1 : (cell_t) id);
 }
 
 void op_sta(vm_t *vm) {
-	vm->memory[atoi(vm->program.lines[vm->pc] + 12)] = popstack(&vm->stack);
+	vm->memory->cells[vm->insn->arg] = popstack(vm->stack);
+	vm->memory->dirty[vm->insn->arg / PAGESZ] = 1;
+}
+
+void op_stl(vm_t *vm) {
+	cell_t *slot = call_local(vm->call_stack, (size_t) vm->insn->arg);
+
+	if (slot == NULL) {
+		fail(vm, "BAD LOCAL SLOT");
+		return;
+	}
+	*slot = popstack(vm->stack);
+}
+
+void op_stx(vm_t *vm) {
+	cell_t *cell = indexed(vm);
+
+	if (cell != NULL) {
+		*cell = popstack(vm->stack);
+		vm->memory->dirty[(cell - vm->memory->cells) / PAGESZ] = 1;
+	}
 }
 
 void op_sub(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) - popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) - popstack(vm->stack));
+}
+
+void op_swp(vm_t *vm) {
+	swapstack(vm->stack);
 }
 
 void op_xor(vm_t *vm) {
-	pushstack(&vm->stack, popstack(&vm->stack) ^ popstack(&vm->stack));
+	pushstack(vm->stack, popstack(vm->stack) ^ popstack(vm->stack));
+}
+
+void op_yld(vm_t *vm) {
+	vm->yield = 1;
 }
@@ -26,12 +26,17 @@ SOFTWARE.
 #include "types.h"
 
 void op_add(vm_t *vm);
+void op_afa(vm_t *vm);
 void op_and(vm_t *vm);
+void op_bad(vm_t *vm);
+void op_bad_address(vm_t *vm);
+void op_bar(vm_t *vm);
 void op_bez(vm_t *vm);
 void op_bnz(vm_t *vm);
 void op_bra(vm_t *vm);
 void op_bls(vm_t *vm);
 void op_brs(vm_t *vm);
+void op_cas(vm_t *vm);
 void op_ceq(vm_t *vm);
 void op_cge(vm_t *vm);
 void op_cgt(vm_t *vm);
@@ -40,14 +45,23 @@ void op_clt(vm_t *vm);
 void op_cne(vm_t *vm);
 void op_dec(vm_t *vm);
 void op_div(vm_t *vm);
+void op_drp(vm_t *vm);
 void op_dup(vm_t *vm);
+void op_end(vm_t *vm);
+void op_ent(vm_t *vm);
+void op_frk(vm_t *vm);
 void op_hlt(vm_t *vm);
 void op_inc(vm_t *vm);
 void op_ich(vm_t *vm);
 void op_ini(vm_t *vm);
 void op_jal(vm_t *vm);
+void op_jnw(vm_t *vm);
+void op_jon(vm_t *vm);
+void op_jtb(vm_t *vm);
 void op_lda(vm_t *vm);
 void op_ldi(vm_t *vm);
+void op_ldl(vm_t *vm);
+void op_ldx(vm_t *vm);
 void op_mod(vm_t *vm);
 void op_mul(vm_t *vm);
 void op_not(vm_t *vm);
@@ -55,10 +69,19 @@ void op_oar(vm_t *vm);
 void op_och(vm_t *vm);
 void op_oti(vm_t *vm);
 void op_ots(vm_t *vm);
+void op_ovr(vm_t *vm);
+void op_pik(vm_t *vm);
+void op_rol(vm_t *vm);
+void op_rot(vm_t *vm);
 void op_rtn(vm_t *vm);
+void op_spn(vm_t *vm);
 void op_sta(vm_t *vm);
+void op_stl(vm_t *vm);
+void op_stx(vm_t *vm);
 void op_sub(vm_t *vm);
+void op_swp(vm_t *vm);
 void op_xor(vm_t *vm);
+void op_yld(vm_t *vm);
 
 #endif
 
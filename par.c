@@ -0,0 +1,211 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "io.h"
+#include "par.h"
+#include "stack.h"
+#include "types.h"
+#include "vm.h"
+
+/* guards vm->workers against par_stop() */
+static pthread_mutex_t teams = PTHREAD_MUTEX_INITIALIZER;
+
+/* let the workers waiting at BAR go on, with team->lock held */
+static void release(team_t *team) {
+	team->waiting = 0;
+	team->round++;
+	pthread_cond_broadcast(&team->opened);
+}
+
+static void *par_worker(void *arg) {
+	vm_t *vm = arg;
+	team_t *team = vm->team;
+
+	execute(vm, team->pc);
+
+	/* the others no longer wait for this one at BAR */
+	pthread_mutex_lock(&team->lock);
+	team->live--;
+	if (team->waiting > 0 && team->waiting >= team->live) {
+		release(team);
+	}
+	pthread_mutex_unlock(&team->lock);
+
+	return NULL;
+}
+
+/* stop vm and its workers, with teams held */
+static void stop(vm_t *vm) {
+	size_t i;
+
+	__atomic_store_n(&vm->done, 1, __ATOMIC_RELAXED);
+	if (vm->workers != NULL) {
+		for (i = 0; i < vm->workers->n && vm->workers->vms[i] != NULL; i++) {
+			stop(vm->workers->vms[i]);
+		}
+		/* and wake them if they're waiting at BAR */
+		pthread_mutex_lock(&vm->workers->lock);
+		pthread_cond_broadcast(&vm->workers->opened);
+		pthread_mutex_unlock(&vm->workers->lock);
+	}
+}
+
+/* start n worker threads at pc, each with its index on its stack */
+void par_fork(vm_t *vm, size_t pc, size_t n) {
+
+	team_t *team;
+	size_t i;
+
+	/* one team at a time */
+	par_join(vm);
+
+	if (n > NWORKERS) {
+		n = NWORKERS;
+	}
+	if (n == 0) {
+		return;
+	}
+
+	team = calloc(1, sizeof(team_t));
+	if (team == NULL) {
+		fprintf(stderr, "ERROR: OUT OF MEMORY (LINE %lu)\n", vm->insn->line);
+		return;
+	}
+	team->pc = pc;
+
+	/* allocate them all before starting any */
+	for (i = 0; i < n; i++) {
+		vm_t *worker = calloc(1, sizeof(vm_t));
+		if (worker == NULL) {
+			fprintf(stderr, "ERROR: OUT OF MEMORY (LINE %lu)\n", vm->insn->line);
+			break;
+		}
+		vm_init(worker, vm->program, vm->memory);
+		input_init(&worker->in, -1);
+		worker->out = vm->out;
+		worker->stats = vm->stats;
+		worker->profile = vm->profile;
+		worker->heat = vm->heat;
+		pushstack(&worker->tasks[0].stack, (cell_t) i);
+		worker->team = team;
+		team->vms[i] = worker;
+	}
+	team->n = team->live = i;
+	pthread_mutex_init(&team->lock, NULL);
+	pthread_cond_init(&team->opened, NULL);
+
+	for (i = 0; i < team->n; i++) {
+		if (pthread_create(&team->threads[i], NULL, par_worker, team->vms[i]) != 0) {
+			fprintf(stderr, "ERROR: CANNOT START WORKER %lu (LINE %lu)\n", i, vm->insn->line);
+			break;
+		}
+	}
+	if (i < team->n) {
+		/* those that did start mustn't wait at BAR for the rest */
+		pthread_mutex_lock(&team->lock);
+		team->live -= team->n - i;
+		if (team->waiting > 0 && team->waiting >= team->live) {
+			release(team);
+		}
+		pthread_mutex_unlock(&team->lock);
+	}
+	for (; i < team->n; i++) {
+		vm_free(team->vms[i]);
+		free(team->vms[i]);
+		team->vms[i] = NULL;
+	}
+
+	pthread_mutex_lock(&teams);
+	vm->workers = team;
+	if (__atomic_load_n(&vm->done, __ATOMIC_RELAXED)) {
+		stop(vm); /* stopped while starting them */
+	}
+	pthread_mutex_unlock(&teams);
+}
+
+/* wait for the workers started by vm to end */
+void par_join(vm_t *vm) {
+
+	team_t *team = vm->workers;
+	size_t i;
+
+	if (team == NULL) {
+		return;
+	}
+
+	/* par_stop() can still reach them while we wait */
+	for (i = 0; i < team->n && team->vms[i] != NULL; i++) {
+		pthread_join(team->threads[i], NULL);
+	}
+
+	/* but not once they're gone */
+	pthread_mutex_lock(&teams);
+	vm->workers = NULL;
+	pthread_mutex_unlock(&teams);
+
+	for (i = 0; i < team->n && team->vms[i] != NULL; i++) {
+		vm_free(team->vms[i]);
+		free(team->vms[i]);
+	}
+
+	pthread_mutex_destroy(&team->lock);
+	pthread_cond_destroy(&team->opened);
+	free(team);
+}
+
+/* stop vm and every worker it started, called from any thread */
+void par_stop(vm_t *vm) {
+	pthread_mutex_lock(&teams);
+	stop(vm);
+	pthread_mutex_unlock(&teams);
+}
+
+/* wait for every worker in vm's team that is still running to get here */
+void par_barrier(vm_t *vm) {
+	team_t *team = vm->team;
+	size_t round;
+
+	if (team == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&team->lock);
+	if (++team->waiting >= team->live) {
+		release(team);
+	} else {
+		round = team->round;
+		while (round == team->round && !__atomic_load_n(&vm->done, __ATOMIC_RELAXED)) {
+			pthread_cond_wait(&team->opened, &team->lock);
+		}
+		if (round == team->round) {
+			team->waiting--; /* stopped */
+		}
+	}
+	pthread_mutex_unlock(&team->lock);
+}
@@ -0,0 +1,431 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "opcodes.h"
+#include "pgo.h"
+#include "types.h"
+#include "util.h"
+#include "vm.h"
+
+/*
+ * Profile guided optimization. --profile-out records how often each source
+ * line ran and how often its branch was taken. --profile-in feeds that back
+ * into the decoded program: small hot sub-routines are inlined at their call
+ * sites, then basic blocks are reordered so hot paths fall through, flipping
+ * BEZ/BNZ and adding or dropping BRAs as needed. Lines, not instruction
+ * indexes, key the profile so it survives the rewriting.
+ */
+
+/* no block */
+#define NONE ((size_t) -1)
+
+/* count the instruction just executed, for instrumented programs */
+void profile_record(vm_t *vm) {
+	insn_t *insn = vm->insn;
+	profile_t *profile = vm->profile;
+	void (*fn)(vm_t *vm) = vm->program->inner[insn - vm->program->code];
+
+	if (insn->line == NOLINE) {
+		return;
+	}
+
+	__atomic_fetch_add(&profile->count[insn->line], 1, __ATOMIC_RELAXED);
+	if (fn == op_bez || fn == op_bnz) {
+		/* taken as written, which a flipped branch is when it falls through */
+		if ((vm->pc == insn->target) != (insn->arg != 0)) {
+			__atomic_fetch_add(&profile->taken[insn->line], 1, __ATOMIC_RELAXED);
+		}
+	} else if (oparg(insn) != ARG_LABEL && oparg(insn) != ARG_TABLE && insn->target != NOLINE) {
+		/* an inlined body starting also counts as its call */
+		__atomic_fetch_add(&profile->count[insn->target], 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* make room for counts of n lines, returns -1 if out of memory */
+int profile_init(profile_t *profile, size_t n) {
+	profile_free(profile);
+	profile->count = calloc(n + 1, sizeof(uint64_t));
+	profile->taken = calloc(n + 1, sizeof(uint64_t));
+	if (profile->count == NULL || profile->taken == NULL) {
+		profile_free(profile);
+		return -1;
+	}
+	profile->n = n;
+	return 0;
+}
+
+void profile_free(profile_t *profile) {
+	free(profile->count);
+	free(profile->taken);
+	memset(profile, '\0', sizeof(profile_t));
+}
+
+/* identifies the program text a profile belongs to */
+static uint64_t fingerprint(program_t *program) {
+	uint64_t h = HASHINIT;
+	size_t i;
+
+	for (i = 0; i < program->sp; i++) {
+		h = hashmore(h, program->lines[i], strlen(program->lines[i]));
+		h = hashmore(h, "\n", 1);
+	}
+
+	return h;
+}
+
+int profile_write(profile_t *profile, program_t *program, const char *path) {
+	FILE *out;
+	size_t i;
+
+	out = fopen(path, "w");
+	if (out == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(out, "tclang-profile %d %016" PRIx64 "\n", PROFVER, fingerprint(program));
+	for (i = 0; i < profile->n; i++) {
+		if (profile->count[i] != 0) {
+			fprintf(out, "%lu %" PRIu64 " %" PRIu64 "\n", i, profile->count[i], profile->taken[i]);
+		}
+	}
+
+	if (fclose(out) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+int profile_read(profile_t *profile, program_t *program, const char *path) {
+	uint64_t h, count, taken;
+	size_t line;
+	int version;
+	FILE *in;
+
+	in = fopen(path, "r");
+	if (in == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	if (fscanf(in, "tclang-profile %d %" SCNx64, &version, &h) != 2 || version != PROFVER || h != fingerprint(program)) {
+		fprintf(stderr, "%s: not a profile of this program\n", path);
+		fclose(in);
+		return -1;
+	}
+
+	if (profile_init(profile, program->sp) == -1) {
+		perror(path);
+		fclose(in);
+		return -1;
+	}
+	while (fscanf(in, "%lu %" SCNu64 " %" SCNu64, &line, &count, &taken) == 3) {
+		if (line < profile->n) {
+			profile->count[line] = count;
+			profile->taken[line] = taken;
+		}
+	}
+
+	fclose(in);
+	return 0;
+}
+
+static uint64_t hits(profile_t *profile, insn_t *insn) {
+	return insn->line == NOLINE ? 0 : profile->count[insn->line];
+}
+
+static int isbranch(insn_t *insn) {
+	return insn->fn == op_bez || insn->fn == op_bnz;
+}
+
+/* control never goes on to the next instruction */
+static int isjump(insn_t *insn) {
+	return insn->fn == op_bra || insn->fn == op_rtn || insn->fn == op_hlt || insn->fn == op_end || insn->fn == op_bad ||
+			insn->fn == op_jtb;
+}
+
+/* point label operands, jump tables, symbols and the entry at new instruction indexes */
+static void remap(program_t *program, size_t *map, size_t n) {
+	size_t i, j;
+
+	for (i = 0; i < program->ncode; i++) {
+		insn_t *insn = &program->code[i];
+		if ((oparg(insn) == ARG_LABEL || oparg(insn) == ARG_TABLE) && insn->target <= n) {
+			insn->target = map[insn->target];
+		}
+	}
+	for (i = 0; i < program->ntables; i++) {
+		jtab_t *table = &program->tables[i];
+		for (j = 0; j < table->n; j++) {
+			if (table->targets[j] <= n) {
+				table->targets[j] = map[table->targets[j]];
+			}
+		}
+	}
+	for (i = 0; i < program->symtab.sp; i++) {
+		if (program->symtab.symbols[i].pc <= n) {
+			program->symtab.symbols[i].pc = map[program->symtab.symbols[i].pc];
+		}
+	}
+	program->entry = map[program->entry];
+}
+
+/* length of the sub-routine body at pc if it may be inlined, else -1 */
+static int inlinable(program_t *program, size_t pc) {
+	size_t i;
+
+	for (i = pc; i < program->ncode && i - pc <= INLINEMAX; i++) {
+		insn_t *insn = &program->code[i];
+		if (insn->fn == op_rtn) {
+			return (int) (i - pc);
+		}
+		/* straight line code only, and nothing that needs its own frame */
+		if (oparg(insn) == ARG_LABEL || isjump(insn) ||
+				insn->fn == op_ent || insn->fn == op_ldl || insn->fn == op_stl) {
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+static void inline_calls(program_t *program, profile_t *profile, uint64_t hot) {
+	size_t i, n, *map;
+	insn_t *code;
+	int len;
+
+	/* each call grows into at most INLINEMAX instructions */
+	code = malloc((program->ncode * INLINEMAX + 1) * sizeof(insn_t));
+	map = malloc((program->ncode + 1) * sizeof(size_t));
+	if (code == NULL || map == NULL) {
+		free(code);
+		free(map);
+		return;
+	}
+
+	for (i = n = 0; i < program->ncode; i++) {
+		insn_t *insn = &program->code[i];
+		map[i] = n;
+		if (insn->fn == op_jal && hits(profile, insn) >= hot && insn->target < program->ncode &&
+				(len = inlinable(program, insn->target)) != -1) {
+			memcpy(&code[n], &program->code[insn->target], (size_t) len * sizeof(insn_t));
+			if (len > 0) {
+				code[n].target = insn->line; /* still counted as the call */
+			}
+			n += (size_t) len;
+		} else {
+			code[n++] = *insn;
+		}
+	}
+
+	map[i] = n;
+	free(program->code);
+	program->code = code;
+	program->ncode = n;
+	remap(program, map, i);
+
+	free(map);
+}
+
+/* the successor of block b that should follow it, NONE if no preference */
+static size_t successor(program_t *program, profile_t *profile, block_t *blocks, size_t *blockof, size_t b) {
+	insn_t *last = &program->code[blocks[b].end - 1];
+	size_t fall = NONE, take = NONE;
+
+	if (blocks[b].end < program->ncode && !isjump(last)) {
+		fall = b + 1;
+	}
+	if ((isbranch(last) || last->fn == op_bra) && last->target < program->ncode) {
+		take = blockof[last->target];
+	}
+
+	/* the more likely way out first */
+	if (isbranch(last) && last->line != NOLINE && profile->taken[last->line] * 2 > profile->count[last->line]) {
+		size_t t = fall;
+		fall = take;
+		take = t;
+	}
+
+	if (fall != NONE && !blocks[fall].placed) {
+		return fall;
+	} else if (take != NONE && !blocks[take].placed) {
+		return take;
+	}
+	return NONE;
+}
+
+/* hottest block not laid out yet, earliest first among equals */
+static size_t seed(block_t *blocks, size_t nblocks) {
+	size_t b, best = NONE;
+
+	for (b = 0; b < nblocks; b++) {
+		if (!blocks[b].placed && (best == NONE || blocks[b].count > blocks[best].count)) {
+			best = b;
+		}
+	}
+
+	return best;
+}
+
+static insn_t *emit_bra(insn_t *insn, size_t target) {
+	insn->fn = op_bra;
+	insn->op = opfind("BRA");
+	insn->line = NOLINE;
+	insn->arg = 0;
+	insn->target = target;
+	return insn + 1;
+}
+
+static void layout(program_t *program, profile_t *profile) {
+	size_t n = program->ncode, nblocks, i, b, k, *blockof, *order, *map;
+	insn_t *code, *out;
+	block_t *blocks;
+	char *leader;
+
+	if (n == 0) {
+		return;
+	}
+
+	leader = calloc(n + 1, 1);
+	blockof = malloc(n * sizeof(size_t));
+	blocks = malloc(n * sizeof(block_t));
+	order = malloc(n * sizeof(size_t));
+	map = malloc((n + 1) * sizeof(size_t));
+	code = malloc(2 * n * sizeof(insn_t));
+	if (leader == NULL || blockof == NULL || blocks == NULL || order == NULL || map == NULL || code == NULL) {
+		goto done;
+	}
+
+	/* anything that can be jumped to starts a block, so does whatever follows a jump */
+	leader[0] = leader[n] = 1;
+	if (program->entry < n) {
+		leader[program->entry] = 1;
+	}
+	for (i = 0; i < program->symtab.sp; i++) {
+		if (program->symtab.symbols[i].pc < n) {
+			leader[program->symtab.symbols[i].pc] = 1;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		insn_t *insn = &program->code[i];
+		if ((oparg(insn) == ARG_LABEL || oparg(insn) == ARG_TABLE) && insn->target < n) {
+			leader[insn->target] = 1;
+		}
+		if (isbranch(insn) || isjump(insn)) {
+			leader[i + 1] = 1;
+		}
+	}
+
+	for (i = nblocks = 0; i < n; i++) {
+		if (leader[i]) {
+			blocks[nblocks].start = i;
+			blocks[nblocks].count = hits(profile, &program->code[i]);
+			blocks[nblocks].placed = 0;
+			nblocks++;
+		}
+		blocks[nblocks - 1].end = i + 1;
+		blockof[i] = nblocks - 1;
+	}
+
+	/* chain blocks along their likely successors, starting at the entry */
+	b = blockof[program->entry < n ? program->entry : 0];
+	for (k = 0; k < nblocks; k++) {
+		if (b == NONE) {
+			b = seed(blocks, nblocks);
+		}
+		blocks[b].placed = 1;
+		order[k] = b;
+		b = successor(program, profile, blocks, blockof, b);
+	}
+
+	/* emit them in that order, fixing up how each block is left */
+	out = code;
+	for (k = 0; k < nblocks; k++) {
+		size_t next = k + 1 < nblocks ? order[k + 1] : NONE, fall = NONE, take = NONE;
+		block_t *blk = &blocks[order[k]];
+		insn_t *last;
+
+		map[blk->start] = (size_t) (out - code);
+		memcpy(out, &program->code[blk->start], (blk->end - blk->start) * sizeof(insn_t));
+		out += blk->end - blk->start;
+		last = out - 1;
+
+		if (!isjump(last)) {
+			fall = blk->end < n ? blockof[blk->end] : NONE;
+		}
+		if ((isbranch(last) || last->fn == op_bra) && last->target < n) {
+			take = blockof[last->target];
+		}
+
+		if (isbranch(last) && take != NONE && take == next && fall != take) {
+			/* flip it so the next block is the fall through */
+			last->fn = last->fn == op_bez ? op_bnz : op_bez;
+			last->op = opfind(last->fn == op_bez ? "BEZ" : "BNZ");
+			last->arg = !last->arg; /* so the profile still counts it as written */
+			last->target = fall == NONE ? n : blocks[fall].start;
+		} else if (last->fn == op_bra && take != NONE && take == next) {
+			out--; /* it would only jump to the next instruction */
+		} else if (!isjump(last) && fall != next) {
+			out = emit_bra(out, fall == NONE ? n : blocks[fall].start);
+		}
+	}
+	map[n] = (size_t) (out - code);
+
+	program->ncode = (size_t) (out - code);
+	free(program->code);
+	program->code = code;
+	code = NULL;
+	remap(program, map, n);
+
+done:
+	free(leader);
+	free(blockof);
+	free(blocks);
+	free(order);
+	free(map);
+	free(code);
+}
+
+void optimize(program_t *program, profile_t *profile) {
+	uint64_t hot = 0;
+	size_t i;
+
+	for (i = 0; i < profile->n; i++) {
+		if (profile->count[i] > hot) {
+			hot = profile->count[i];
+		}
+	}
+	hot = hot / HOTFRAC + 1;
+
+	inline_calls(program, profile, hot);
+	layout(program, profile);
+}
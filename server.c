@@ -0,0 +1,387 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "const.h"
+#include "io.h"
+#include "loader.h"
+#include "par.h"
+#include "server.h"
+#include "types.h"
+#include "util.h"
+#include "vm.h"
+
+/*
+ * Protocol, one request per connection:
+ *
+ *   client: "tclang LENGTH\n" TEXT	the program text
+ *   server: "ok\n"
+ *
+ * After "ok" the rest of the client's stream is the program's standard input
+ * and the rest of the server's stream is its standard output. The server
+ * closes the connection when the program ends. Bad requests get "error ...\n".
+ * A program is stopped when its client hangs up or it runs past --timeout.
+ */
+
+static cached_t cache[CACHESZ];
+
+/* seconds a request may run, 0 for no limit */
+static int timeout;
+
+static size_t cache_tick;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* whether cache entry c holds the program text of length len with hash h */
+static int cache_match(cached_t *c, uint64_t h, const char *text, size_t len) {
+	return c->program != NULL && c->hash == h && c->len == len && memcmp(c->text, text, len) == 0;
+}
+
+/* look up a decoded program, holding a reference to it */
+static program_t *cache_get(uint64_t h, const char *text, size_t len) {
+	program_t *program = NULL;
+	size_t i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < CACHESZ; i++) {
+		if (cache_match(&cache[i], h, text, len)) {
+			cache[i].refs++;
+			cache[i].used = ++cache_tick;
+			program = cache[i].program;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return program;
+}
+
+/* add a decoded program and its text, returns the one to use (holding a reference) */
+/* the cache owns text from now on */
+static program_t *cache_put(uint64_t h, char *text, size_t len, program_t *program) {
+	cached_t *victim = NULL;
+	size_t i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < CACHESZ; i++) {
+		if (cache_match(&cache[i], h, text, len)) {
+			/* someone else loaded it first */
+			cache[i].refs++;
+			cache[i].used = ++cache_tick;
+			program_free(program);
+			free(program);
+			program = cache[i].program;
+			break;
+		}
+		/* prefer an empty slot, else the least recently used idle one */
+		if (cache[i].program == NULL) {
+			if (victim == NULL || victim->program != NULL) {
+				victim = &cache[i];
+			}
+		} else if (cache[i].refs == 0 && (victim == NULL || (victim->program != NULL && cache[i].used < victim->used))) {
+			victim = &cache[i];
+		}
+	}
+	if (i == CACHESZ && victim != NULL) {
+		if (victim->program != NULL) {
+			program_free(victim->program);
+			free(victim->program);
+			free(victim->text);
+		}
+		victim->hash = h;
+		victim->text = text;
+		victim->len = len;
+		victim->program = program;
+		victim->refs = 1;
+		victim->used = ++cache_tick;
+	}
+	if (i < CACHESZ || victim == NULL) {
+		free(text);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	/* if everything is busy the program just isn't cached */
+	return program;
+}
+
+static void cache_release(program_t *program) {
+	size_t i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < CACHESZ; i++) {
+		if (cache[i].program == program) {
+			cache[i].refs--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	if (i == CACHESZ) {
+		program_free(program);
+		free(program);
+	}
+}
+
+/* receive len bytes of program text, NULL on error */
+static char *receive(input_t *in, size_t len) {
+	char *text;
+	size_t i;
+	int c;
+
+	text = malloc(len);
+	if (text == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < len && (c = input_getc(in)) != EOF; i++) {
+		text[i] = (char) c;
+	}
+	if (i < len) {
+		free(text);
+		return NULL;
+	}
+
+	return text;
+}
+
+/* decode the program text, NULL on error */
+static program_t *build(const char *text, size_t len) {
+	program_t *program;
+
+	program = malloc(sizeof(program_t));
+	if (program == NULL || load(program, text, len) == -1) {
+		free(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+/* stop the request on slot if its client goes away or it runs out of time */
+static void *watch(void *arg) {
+	slot_t *slot = arg;
+	struct pollfd fds[2];
+	char c;
+	int n;
+
+	fds[0].fd = slot->fd;
+	fds[0].events = 0; /* only hang ups */
+	fds[1].fd = slot->wake[0];
+	fds[1].events = POLLIN;
+
+	do {
+		n = poll(fds, 2, timeout > 0 ? timeout * 1000 : -1);
+	} while (n == -1 && errno == EINTR);
+
+	if (!(fds[1].revents & POLLIN)) {
+		if (n == 0) {
+			fprintf(stderr, "ERROR: REQUEST TIMED OUT\n");
+		}
+		/* unblock reads and writes of the connection, then stop the vms */
+		shutdown(slot->fd, SHUT_RDWR);
+		par_stop(&slot->vm);
+	}
+
+	while (read(slot->wake[0], &c, 1) == -1 && errno == EINTR) {
+		continue;
+	}
+	return NULL;
+}
+
+/* whether the watcher has already shut the connection down */
+static int shut_down(int fd) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = 0;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLHUP);
+}
+
+static void serve_client(slot_t *slot, int fd) {
+	vm_t *vm = &slot->vm;
+	program_t *program = NULL;
+	char line[LNLEN], *text;
+	uint64_t h;
+	size_t len;
+	FILE *out = NULL;
+	int watching;
+
+	/* the time limit covers receiving the program too, so a client that */
+	/* never sends it doesn't hold on to the slot */
+	slot->fd = fd;
+	watching = pthread_create(&slot->watcher, NULL, watch, slot) == 0;
+
+	/* the handshake is read through the vm's input buffer, so anything */
+	/* the client sends after it is already there as standard input */
+	input_init(&vm->in, fd);
+	if (input_gets(&vm->in, line, sizeof(line)) == NULL || sscanf(line, "tclang %lu", &len) != 1 ||
+			len == 0 || len > PROGMAX) {
+		dprintf(fd, "error bad request\n");
+		goto done;
+	}
+	if ((text = receive(&vm->in, len)) == NULL) {
+		dprintf(fd, "error bad program\n");
+		goto done;
+	}
+
+	/* a hash match is only a hint, cache_get() compares the text too */
+	h = hash(text, len);
+	program = cache_get(h, text, len);
+	if (program != NULL) {
+		free(text);
+	} else {
+		program = build(text, len);
+		if (program == NULL) {
+			free(text);
+			dprintf(fd, "error bad program\n");
+			goto done;
+		}
+		program = cache_put(h, text, len, program);
+	}
+
+	out = fdopen(dup(fd), "w");
+	if (out == NULL) {
+		dprintf(fd, "error %s\n", strerror(errno));
+		goto done;
+	}
+	dprintf(fd, "ok\n");
+
+	memreset(&slot->memory);
+	vm_init(vm, program, &slot->memory);
+	vm->out = out;
+	if (shut_down(fd)) {
+		vm->done = 1; /* stopped before vm_init() */
+	}
+
+	execute(vm, program->entry);
+
+done:
+	if (watching) {
+		while (write(slot->wake[1], "", 1) == -1 && errno == EINTR) {
+			continue;
+		}
+		pthread_join(slot->watcher, NULL);
+	}
+
+	if (out != NULL) {
+		fclose(out);
+	}
+	if (program != NULL) {
+		cache_release(program);
+	}
+}
+
+static void *serve_loop(void *arg) {
+	slot_t *slot = arg;
+	int fd;
+
+	for (;;) {
+		fd = accept(slot->sock, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			perror("accept");
+			break;
+		}
+		serve_client(slot, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* accept requests on the unix domain socket at path, only returns on error */
+/* a request running longer than limit seconds is stopped, 0 for no limit */
+int serve(const char *path, stats_t *stats, int limit) {
+	struct sockaddr_un addr;
+	slot_t *slots;
+	size_t i;
+	int sock;
+
+	/* a client going away must not take the server with it */
+	signal(SIGPIPE, SIG_IGN);
+	timeout = limit;
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sock, SOMAXCONN) == -1) {
+		perror(path);
+		close(sock);
+		return -1;
+	}
+
+	slots = calloc(POOLSZ, sizeof(slot_t));
+	if (slots == NULL) {
+		perror("calloc");
+		close(sock);
+		return -1;
+	}
+
+	for (i = 0; i < POOLSZ; i++) {
+		slots[i].sock = sock;
+		if (pipe(slots[i].wake) == -1) {
+			perror("pipe");
+			break;
+		}
+		if (stats != NULL) {
+			vm_stats(&slots[i].vm, stats);
+		}
+		if (pthread_create(&slots[i].thread, NULL, serve_loop, &slots[i]) != 0) {
+			fprintf(stderr, "ERROR: CANNOT START SERVER THREAD %lu\n", i);
+			break;
+		}
+	}
+	while (i-- > 0) {
+		pthread_join(slots[i].thread, NULL);
+	}
+
+	free(slots);
+	close(sock);
+	return -1;
+}
@@ -21,6 +21,10 @@ SOFTWARE.
 ******************************************************************************/
 
 #include "config.h"
+
+#include <stddef.h>
+#include <string.h>
+
 #include "stack.h"
 #include "types.h"
 
@@ -48,3 +52,60 @@ void pushstack(stk_t *stack, cell_t c) {
 	stack->sp++;
 }
 
+/*
+ * Items missing from the bottom of the stack read as 0, as with popstack().
+ * Depths count from the top, which is at depth 0.
+ */
+
+/* push a copy of the item at depth n */
+void pickstack(stk_t *stack, size_t n) {
+	pushstack(stack, n < stack->sp ? stack->mem[stack->sp - 1 - n] : 0);
+}
+
+/* move the item at depth n to the top */
+void rollstack(stk_t *stack, size_t n) {
+	cell_t c;
+
+	if (n >= stack->sp) {
+		pushstack(stack, 0);
+		return;
+	}
+
+	c = stack->mem[stack->sp - 1 - n];
+	memmove(&stack->mem[stack->sp - 1 - n], &stack->mem[stack->sp - n], n * sizeof(cell_t));
+	stack->mem[stack->sp - 1] = c;
+}
+
+/* a b -- b a */
+void swapstack(stk_t *stack) {
+	cell_t c;
+
+	if (stack->sp < 2) {
+		rollstack(stack, 1);
+		return;
+	}
+
+	c = stack->mem[stack->sp - 1];
+	stack->mem[stack->sp - 1] = stack->mem[stack->sp - 2];
+	stack->mem[stack->sp - 2] = c;
+}
+
+/* a b -- a b a */
+void overstack(stk_t *stack) {
+	pickstack(stack, 1);
+}
+
+/* a b c -- b c a */
+void rotstack(stk_t *stack) {
+	cell_t c;
+
+	if (stack->sp < 3) {
+		rollstack(stack, 2);
+		return;
+	}
+
+	c = stack->mem[stack->sp - 3];
+	stack->mem[stack->sp - 3] = stack->mem[stack->sp - 2];
+	stack->mem[stack->sp - 2] = stack->mem[stack->sp - 1];
+	stack->mem[stack->sp - 1] = c;
+}
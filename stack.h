@@ -23,10 +23,17 @@ SOFTWARE.
 #ifndef __STACK_H
 #define __STACK_H
 
+#include <stddef.h>
+
 #include "types.h"
 
 cell_t peekstack(stk_t *stack);
 cell_t popstack(stk_t *stack);
 void pushstack(stk_t *stack, cell_t c);
+void pickstack(stk_t *stack, size_t n);
+void rollstack(stk_t *stack, size_t n);
+void swapstack(stk_t *stack);
+void overstack(stk_t *stack);
+void rotstack(stk_t *stack);
 
 #endif
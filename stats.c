@@ -0,0 +1,138 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "const.h"
+#include "stats.h"
+#include "types.h"
+
+/*
+ * The stats segment is POSIX shared memory named /tclang.PID holding one
+ * stats_t. Writers only ever add to it with relaxed atomics, in batches of
+ * STATBATCH instructions, so publishing costs next to nothing and readers
+ * like tclang-stat may see counters that are a batch behind.
+ */
+
+/* name of our segment, for the signal handler */
+static char segment[32];
+
+/* name of the segment for process pid, name must hold 32 chars */
+void statname(char *name, unsigned int pid) {
+	snprintf(name, 32, "/tclang.%u", pid);
+}
+
+/* don't leave the segment behind when interrupted or terminated */
+static void unlink_and_die(int sig) {
+	shm_unlink(segment);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+stats_t *stats_open(void) {
+	stats_t *stats;
+	char name[32];
+	int fd;
+
+	statname(name, (unsigned int) getpid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(name);
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(stats_t)) == -1) {
+		perror(name);
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	stats = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) {
+		perror(name);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	stats->version = STATVER;
+	stats->pid = (uint32_t) getpid();
+	__atomic_store_n(&stats->magic, STATMAGIC, __ATOMIC_RELEASE);
+
+	memcpy(segment, name, sizeof(segment));
+	signal(SIGINT, unlink_and_die);
+	signal(SIGTERM, unlink_and_die);
+
+	return stats;
+}
+
+void stats_close(stats_t *stats) {
+	char name[32];
+
+	if (stats == NULL) {
+		return;
+	}
+
+	statname(name, stats->pid);
+	munmap(stats, sizeof(stats_t));
+	shm_unlink(name);
+}
+
+static void stats_max(uint64_t *peak, uint64_t val) {
+	uint64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while (old < val && !__atomic_compare_exchange_n(peak, &old, val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		;
+	}
+}
+
+/* publish vm's tally */
+void stats_flush(vm_t *vm) {
+	stats_t *stats = vm->stats;
+	tally_t *tally = &vm->tally;
+	size_t i;
+
+	for (i = 0; i < MAXOPS; i++) {
+		if (tally->ops[i] != 0) {
+			__atomic_fetch_add(&stats->ops[i], tally->ops[i], __ATOMIC_RELAXED);
+			tally->ops[i] = 0;
+		}
+	}
+	__atomic_fetch_add(&stats->insns, tally->insns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->out, tally->out, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->in, vm->in.total - tally->in, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->stack, vm->stack->sp, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->call, vm->call_stack->sp, __ATOMIC_RELAXED);
+	stats_max(&stats->stack_peak, tally->stack_peak);
+	stats_max(&stats->call_peak, tally->call_peak);
+
+	tally->insns = 0;
+	tally->out = 0;
+	tally->in = vm->in.total;
+}
@@ -23,28 +23,92 @@ SOFTWARE.
 #include "config.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "const.h"
 #include "symtab.h"
 #include "types.h"
+#include "util.h"
 
-void symdef(symtab_t *symtab, char *label, size_t lineno) {
-	strncpy(symtab->symbols[symtab->sp].label, label, LBLLN);
-	symtab->symbols[symtab->sp].lineno = lineno;
-	symtab->sp++;
+static size_t *symslot(symtab_t *symtab, char *label) {
+	size_t mask = symtab->nbuckets - 1, i;
+
+	i = (size_t) hash(label, strlen(label)) & mask;
+	while (symtab->buckets[i] != 0 && strcmp(symtab->symbols[symtab->buckets[i] - 1].label, label) != 0) {
+		i = (i + 1) & mask;
+	}
+
+	return &symtab->buckets[i];
 }
 
-size_t symfind(symtab_t *symtab, char *label) {
-	size_t i;
+/* keep the hash table at most half full */
+static int symgrow(symtab_t *symtab) {
+	size_t *old = symtab->buckets, n = symtab->nbuckets, i;
+
+	symtab->nbuckets = n ? n * 2 : 64;
+	symtab->buckets = calloc(symtab->nbuckets, sizeof(size_t));
+	if (symtab->buckets == NULL) {
+		symtab->buckets = old;
+		symtab->nbuckets = n;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (old[i] != 0) {
+			*symslot(symtab, symtab->symbols[old[i] - 1].label) = old[i];
+		}
+	}
+	free(old);
+
+	return 0;
+}
 
-	for (i = 0; i < symtab->sp; i++) {	
-		if (strcmp(symtab->symbols[i].label, label) == 0) {
-			return symtab->symbols[i].lineno;
+/* define label, the first definition of a label wins, returns -1 if out of memory */
+int symdef(symtab_t *symtab, char *label, size_t pc) {
+	symbol_t *symbols;
+	size_t *slot;
+
+	if (symtab->sp == symtab->cap) {
+		symtab->cap = symtab->cap ? symtab->cap * 2 : 64;
+		symbols = realloc(symtab->symbols, symtab->cap * sizeof(symbol_t));
+		if (symbols == NULL) {
+			symtab->cap = symtab->sp;
+			return -1;
 		}
+		symtab->symbols = symbols;
+	}
+	if ((symtab->sp + 1) * 2 > symtab->nbuckets && symgrow(symtab) == -1) {
+		return -1;
+	}
+
+	slot = symslot(symtab, label);
+	if (*slot != 0) {
+		return 0;
+	}
+
+	strncpy(symtab->symbols[symtab->sp].label, label, LBLLN - 1);
+	symtab->symbols[symtab->sp].label[LBLLN - 1] = '\0';
+	symtab->symbols[symtab->sp].pc = pc;
+	symtab->sp++;
+	*slot = symtab->sp;
+
+	return 0;
+}
 
+size_t symfind(symtab_t *symtab, char *label) {
+	size_t *slot;
+
+	if (symtab->nbuckets == 0) {
+		return NOSYM;
 	}
 
-	return LNMAX + 1;
+	slot = symslot(symtab, label);
+	return *slot == 0 ? NOSYM : symtab->symbols[*slot - 1].pc;
 }
 
+void symfree(symtab_t *symtab) {
+	free(symtab->symbols);
+	free(symtab->buckets);
+	memset(symtab, '\0', sizeof(symtab_t));
+}
@@ -26,7 +26,8 @@ SOFTWARE.
 #include <stddef.h>
 #include "types.h"
 
-void symdef(symtab_t *symtab, char *label, size_t lineno);
+int symdef(symtab_t *symtab, char *label, size_t pc);
 size_t symfind(symtab_t *symtab, char *label);
+void symfree(symtab_t *symtab);
 
 #endif
@@ -0,0 +1,163 @@
+/******************************************************************************
+Copyright (c) 2019 Thomas Cort
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+******************************************************************************/
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "call.h"
+#include "io.h"
+#include "task.h"
+#include "types.h"
+
+/* make task id the running task */
+void task_enter(vm_t *vm, size_t id) {
+	task_t *task = &vm->tasks[id];
+
+	task->state = TASK_READY;
+	vm->task = id;
+	vm->stack = &task->stack;
+	vm->call_stack = &task->call_stack;
+	vm->pc = task->pc;
+}
+
+/* start a new task at pc, returns its id or NTASKS if all slots are taken */
+size_t task_spawn(vm_t *vm, size_t pc) {
+	size_t id;
+
+	for (id = 0; id < NTASKS; id++) {
+		if (vm->tasks[id].state == TASK_FREE) {
+			vm->tasks[id].stack.sp = 0;
+			call_reset(&vm->tasks[id].call_stack);
+			vm->tasks[id].pc = pc;
+			vm->tasks[id].state = TASK_READY;
+			break;
+		}
+	}
+
+	return id;
+}
+
+/* end the running task */
+void task_end(vm_t *vm) {
+	vm->tasks[vm->task].state = TASK_DONE;
+	vm->yield = 1;
+}
+
+/* returns non-zero when the running task must wait for task id to end */
+int task_join(vm_t *vm, size_t id) {
+	size_t i;
+
+	if (id >= NTASKS || id == vm->task || vm->tasks[id].state == TASK_FREE) {
+		return 0;
+	} else if (vm->tasks[id].state == TASK_DONE) {
+		/* the last one to see it ended frees the slot */
+		for (i = 0; i < NTASKS; i++) {
+			if (i != vm->task && vm->tasks[i].state == TASK_JOIN && vm->tasks[i].join == id) {
+				return 0;
+			}
+		}
+		vm->tasks[id].state = TASK_FREE;
+		return 0;
+	}
+
+	vm->tasks[vm->task].state = TASK_JOIN;
+	vm->tasks[vm->task].join = id;
+	vm->yield = 1;
+	return 1;
+}
+
+static int task_runnable(vm_t *vm, size_t id) {
+	task_t *task = &vm->tasks[id];
+
+	switch (task->state) {
+		case TASK_READY:
+			return 1;
+		case TASK_JOIN:
+			return vm->tasks[task->join].state == TASK_DONE;
+		case TASK_INPUT:
+			return task->line ? input_line_ready(&vm->in) : input_ready(&vm->in);
+		default:
+			return 0;
+	}
+}
+
+/*
+ * returns non-zero when the running task should give up the cpu rather than
+ * block reading standard input, a byte or if line is set a whole line. It
+ * only yields if there is someone to run, else it flushes standard output.
+ */
+int task_wait_input(vm_t *vm, int line) {
+	size_t i;
+
+	if (line ? input_line_ready(&vm->in) : input_ready(&vm->in)) {
+		return 0;
+	}
+
+	for (i = 0; i < NTASKS; i++) {
+		if (i != vm->task && task_runnable(vm, i)) {
+			vm->tasks[vm->task].state = TASK_INPUT;
+			vm->tasks[vm->task].line = line;
+			vm->yield = 1;
+			return 1;
+		}
+	}
+
+	/* about to block, so let whoever is on the other end see a prompt first */
+	fflush(vm->out);
+	return 0;
+}
+
+/* round robin to the next runnable task */
+void task_switch(vm_t *vm) {
+	size_t i, id;
+
+	vm->yield = 0;
+	vm->tasks[vm->task].pc = vm->pc;
+
+	for (i = 1; i <= NTASKS; i++) {
+		id = (vm->task + i) % NTASKS;
+		if (task_runnable(vm, id)) {
+			task_enter(vm, id);
+			return;
+		}
+	}
+
+	/* nobody can make progress without input, so block on it */
+	for (i = 1; i <= NTASKS; i++) {
+		id = (vm->task + i) % NTASKS;
+		if (vm->tasks[id].state == TASK_INPUT) {
+			task_enter(vm, id);
+			return;
+		}
+	}
+
+	for (id = 0; id < NTASKS; id++) {
+		if (vm->tasks[id].state == TASK_JOIN) {
+			fprintf(stderr, "ERROR: DEADLOCK (TASK %lu)\n", id);
+			break;
+		}
+	}
+
+	vm->done = 1;
+}
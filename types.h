@@ -23,58 +23,272 @@ SOFTWARE.
 #ifndef __TYPES_H
 #define __TYPES_H
 
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "const.h"
 
 /* basic data type for storage (memory and stack) */
 typedef int32_t cell_t;
 
+struct mem {
+	cell_t cells[MEMSZ];			/* main memory */
+	unsigned char dirty[MEMSZ / PAGESZ];	/* pages written since last reset */
+};
+typedef struct mem mem_t;
+
 struct stack {
 	cell_t mem[STKSZ];	/* array of memory cells used by this stack */
 	size_t sp;		/* stack pointer */
 };
 typedef struct stack stk_t;
 
+/* what JAL saves for RTN */
+struct frame {
+	size_t ret;		/* return address */
+	size_t fp;		/* caller's frame pointer */
+};
+typedef struct frame frame_t;
+
 struct call_stack {
-	size_t mem[CSTKSZ];	/* array of memory cells used by this stack */
+	frame_t *frames;	/* return addresses and saved frame pointers */
+	cell_t *locals;		/* local slots of every frame */
 	size_t sp;		/* stack pointer */
+	size_t cap;		/* room in frames */
+	size_t fp;		/* frame pointer, first local slot of the current frame */
+	size_t lp;		/* one past the last local slot in use */
+	size_t lcap;		/* room in locals */
 };
 typedef struct call_stack call_stk_t;
 
 struct symbol {
 	char label[LBLLN];	/* label name + '\0' */
-	size_t lineno;		/* line on which the label appears */
+	size_t pc;		/* instruction following the label */
 };
 typedef struct symbol symbol_t;
 
 struct symtab {
-	symbol_t symbols[SYMSZ];	/* stack of symbols */
+	symbol_t *symbols;		/* stack of symbols */
 	size_t sp;			/* pointer to top of stack */
+	size_t cap;			/* room in symbols */
+	size_t *buckets;		/* hash table of symbol index + 1, 0 if empty */
+	size_t nbuckets;		/* size of buckets, a power of 2 */
 };
 typedef struct symtab symtab_t;
 
+struct vm;
+
+struct insn {
+	void (*fn)(struct vm *vm);	/* opcode implementation */
+	size_t target;			/* resolved label operand, else the line of the */
+					/* call whose inlined body this starts, or NOLINE */
+	size_t line;			/* source line of the instruction */
+	cell_t arg;			/* numeric operand, for BEZ and BNZ set if layout flipped them */
+	int op;				/* index into the opcode table, -1 if bad */
+};
+typedef struct insn insn_t;
+
+/* jump table declared by TBL */
+struct jtab {
+	size_t *targets;		/* resolved labels, in order */
+	size_t n;			/* number of labels */
+	size_t line;			/* line of the TBL directive */
+};
+typedef struct jtab jtab_t;
+
 struct program {
-	char lines[LNMAX][LNLEN];	/* store whole program text here */
+	char *text;			/* whole program text, one string per line */
+	char **lines;			/* start of each line in text */
 	size_t sp;			/* pointer to last line */
+	insn_t *code;			/* decoded instructions */
+	size_t ncode;			/* number of instructions */
+	size_t entry;			/* where execution starts */
+	symtab_t symtab;		/* symbol table */
+	jtab_t *tables;			/* jump tables */
+	size_t ntables;			/* number of jump tables */
+	symtab_t tabsyms;		/* names of jump tables */
+	void (**inner)(struct vm *vm);	/* what each instrumented instruction wraps */
 };
 typedef struct program program_t;
 
-struct vm {
-	cell_t memory[MEMSZ];		/* main memory */
-	stk_t stack;			/* working stack */
+/* a piece of program text decoded on its own by a loader thread */
+struct chunk {
+	const char *src;		/* the source text of the chunk */
+	size_t len;			/* its length */
+	char *text;			/* where to copy it in the program's text */
+	char **lines;			/* start of each line */
+	size_t nlines;			/* number of lines */
+	size_t linecap;			/* room in lines */
+	insn_t *code;			/* decoded instructions, lines relative to the chunk */
+	size_t ncode;			/* number of instructions */
+	size_t codecap;			/* room in code */
+	symbol_t *symbols;		/* labels, pcs relative to the chunk */
+	size_t nsyms;			/* number of labels */
+	size_t symcap;			/* room in symbols */
+	symbol_t *tables;		/* jump table names, pcs are their lines */
+	size_t ntables;			/* number of jump tables */
+	size_t tablecap;		/* room in tables */
+	size_t line0;			/* index of the chunk's first line in the program */
+	size_t pc0;			/* index of the chunk's first instruction */
+	size_t tbl0;			/* index of the chunk's first jump table */
+	program_t *program;		/* program being loaded */
+	pthread_t thread;		/* thread working on the chunk */
+	int joinable;			/* thread was started */
+	int error;			/* ran out of memory */
+};
+typedef struct chunk chunk_t;
+
+struct task {
+	stk_t stack;		/* working stack */
 	call_stk_t call_stack;	/* call stack */
-	symtab_t symtab;		/* symbol table */
-	program_t program;		/* text of program */
-	size_t pc;			/* program counter */
-	int done;			/* flag to indicate when to quit */
+	size_t pc;		/* program counter while not running */
+	size_t join;		/* task being waited on (TASK_JOIN) */
+	int state;		/* one of the TASK_* states */
+	int line;		/* waiting for a whole line (TASK_INPUT) */
+};
+typedef struct task task_t;
+
+struct input {
+	char buf[INBUFSZ];	/* bytes read from fd but not yet consumed */
+	size_t pos;		/* next unconsumed byte in buf */
+	size_t len;		/* number of valid bytes in buf */
+	uint64_t total;		/* bytes read so far */
+	int fd;			/* file descriptor to read from */
+	int eof;		/* set once fd hits end of file or an error */
+};
+typedef struct input input_t;
+
+/* live counters published in shared memory, see stats.c */
+struct stats {
+	uint32_t magic;			/* STATMAGIC */
+	uint32_t version;		/* STATVER */
+	uint32_t pid;			/* process publishing the stats */
+	uint32_t nops;			/* entries used in names and ops */
+	char names[MAXOPS][4];		/* opcode names */
+	uint64_t ops[MAXOPS];		/* instructions executed per opcode */
+	uint64_t insns;			/* instructions executed */
+	uint64_t stack;			/* current working stack depth */
+	uint64_t stack_peak;		/* peak working stack depth */
+	uint64_t call;			/* current call stack depth */
+	uint64_t call_peak;		/* peak call stack depth */
+	uint64_t out;			/* bytes written to standard output */
+	uint64_t in;			/* bytes read from standard input */
+};
+typedef struct stats stats_t;
+
+/* execution profile for --profile-out and --profile-in, indexed by line */
+struct profile {
+	uint64_t *count;		/* times instructions on the line ran */
+	uint64_t *taken;		/* times the branch on the line was taken */
+	size_t n;			/* number of lines */
+};
+typedef struct profile profile_t;
+
+/* how one line of the program walks memory, for --heatmap */
+struct access {
+	uint64_t count;			/* accesses made by the line */
+	uint64_t strided;		/* accesses the same stride after the one before */
+	size_t last;			/* address of the last access */
+	size_t lo;			/* lowest address accessed */
+	size_t hi;			/* highest address accessed */
+	ptrdiff_t stride;		/* distance between the last two accesses */
+};
+typedef struct access access_t;
+
+/* memory access counts for --heatmap */
+struct heat {
+	uint64_t reads[MEMSZ];		/* reads per memory cell */
+	uint64_t writes[MEMSZ];		/* writes per memory cell */
+	access_t *lines;		/* access pattern per line */
+	size_t n;			/* number of lines */
+};
+typedef struct heat heat_t;
+
+/* basic block of a program, for laying out code with a profile */
+struct block {
+	size_t start;			/* first instruction */
+	size_t end;			/* one past the last instruction */
+	uint64_t count;			/* times the block ran */
+	int placed;			/* already laid out */
 	char pad[4];
 };
+typedef struct block block_t;
+
+/* a vm's counts since it last updated the stats segment */
+struct tally {
+	uint64_t ops[MAXOPS];		/* instructions executed per opcode */
+	uint64_t insns;			/* instructions executed */
+	uint64_t out;			/* bytes written to standard output */
+	uint64_t in;			/* value of in.total at the last update */
+	size_t stack_peak;		/* peak working stack depth */
+	size_t call_peak;		/* peak call stack depth */
+};
+typedef struct tally tally_t;
+
+struct team;
+
+struct vm {
+	mem_t *memory;			/* main memory (shared with workers) */
+	program_t *program;		/* text of program (shared with workers) */
+	task_t tasks[NTASKS];		/* green threads */
+	stk_t *stack;			/* working stack of running task */
+	call_stk_t *call_stack;	/* call stack of running task */
+	struct team *workers;		/* workers started by FRK */
+	struct team *team;		/* team this vm is a worker in */
+	insn_t *insn;			/* instruction being executed */
+	FILE *out;			/* standard output */
+	input_t in;			/* standard input */
+	stats_t *stats;			/* where to publish stats, or NULL */
+	tally_t tally;			/* counts not yet published */
+	profile_t *profile;		/* where to record a profile, or NULL */
+	heat_t *heat;			/* where to count memory accesses, or NULL */
+	size_t pc;			/* program counter (next instruction) */
+	size_t task;			/* index of running task */
+	int done;			/* flag to indicate when to quit */
+	int yield;			/* flag to switch tasks after this op */
+};
 typedef struct vm vm_t;
 
+struct team {
+	vm_t *vms[NWORKERS];		/* one vm per worker thread */
+	pthread_t threads[NWORKERS];	/* worker threads */
+	pthread_mutex_t lock;		/* guards the barrier */
+	pthread_cond_t opened;		/* signalled when the barrier opens */
+	size_t live;			/* workers that haven't ended */
+	size_t waiting;			/* workers waiting at BAR */
+	size_t round;			/* times the barrier has opened */
+	size_t n;			/* number of workers */
+	size_t pc;			/* where the workers start */
+};
+typedef struct team team_t;
+
+struct slot {
+	vm_t vm;			/* warm vm, reused for every request */
+	mem_t memory;			/* its main memory */
+	pthread_t thread;		/* thread serving requests with it */
+	pthread_t watcher;		/* thread watching the current request */
+	int sock;			/* listening socket */
+	int fd;				/* connection of the current request */
+	int wake[2];			/* pipe telling the watcher the request is over */
+};
+typedef struct slot slot_t;
+
+struct cached {
+	uint64_t hash;			/* hash of the program text */
+	char *text;			/* the program text, to compare on a hit */
+	size_t len;			/* its length */
+	program_t *program;		/* decoded program */
+	size_t refs;			/* number of requests using it */
+	size_t used;			/* when it was last used, for eviction */
+};
+typedef struct cached cached_t;
+
 struct operation {
 	char code[4];
+	int arg;		/* kind of operand, one of the ARG_* constants */
+	int deepens;		/* can push more than it pops, or make a call */
 	char pad[4];
 	void (*fn)(vm_t *vm);
 };
@@ -23,18 +23,69 @@ SOFTWARE.
 #include "config.h"
 
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "util.h"
 
-void chomp(char *line) {
-	size_t end = strlen(line) - 1;
-	if (line[end] == '\n') {
-		line[end] = '\0';
-		end--;
+
+/* 64-bit FNV-1a */
+uint64_t hash(const char *buf, size_t len) {
+	return hashmore(HASHINIT, buf, len);
+}
+
+/* continue hash h over more bytes */
+uint64_t hashmore(uint64_t h, const char *buf, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char) buf[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+/* make room for element n of an array of size byte elements with room for *cap */
+int grow(void **array, size_t *cap, size_t n, size_t size) {
+	size_t bigger;
+	void *p;
+
+	if (n < *cap) {
+		return 0;
 	}
-	if (line[end] == '\r') {
-		line[end] = '\0';
+
+	bigger = *cap ? *cap * 2 : 256;
+	p = realloc(*array, bigger * size);
+	if (p == NULL) {
+		return -1;
 	}
+	*array = p;
+	*cap = bigger;
+
+	return 0;
 }
 
+/* read all of in into a new buffer, NULL on error */
+char *slurp(FILE *in, size_t *len) {
+	char *text = NULL;
+	size_t size = 0;
+
+	*len = 0;
+	do {
+		if (grow((void **) &text, &size, *len, 1) == -1) {
+			free(text);
+			return NULL;
+		}
+		*len += fread(text + *len, 1, size - *len, in);
+	} while (!feof(in) && !ferror(in));
+
+	if (ferror(in)) {
+		free(text);
+		return NULL;
+	}
+
+	return text;
+}
@@ -24,8 +24,16 @@ SOFTWARE.
 #define __UTIL_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
-void chomp(char *line);
+uint64_t hash(const char *buf, size_t len);
+uint64_t hashmore(uint64_t h, const char *buf, size_t len);
+int grow(void **array, size_t *cap, size_t n, size_t size);
+char *slurp(FILE *in, size_t *len);
+
+/* hash of nothing */
+#define HASHINIT (14695981039346656037ULL)
 
 #endif
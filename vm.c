@@ -30,103 +30,350 @@ SOFTWARE.
 
 #include "call.h"
 #include "const.h"
+#include "io.h"
 #include "opcodes.h"
+#include "par.h"
+#include "pgo.h"
+#include "stats.h"
 #include "stack.h"
 #include "symtab.h"
+#include "task.h"
 #include "types.h"
 #include "util.h"
 
-#define op(NAME, FUNC) { { NAME }, { 0, 0, 0, 0 }, FUNC }
+#define op(NAME, FUNC, ARG, DEEPENS) { { NAME }, ARG, DEEPENS, { 0 }, FUNC }
 
-#define NOPS (34)
+#define NOPS (55)
 static op_t opcodes[NOPS] = {
-	op("ADD", op_add),
-	op("AND", op_and),
-	op("BEZ", op_bez),
-	op("BLS", op_bls),
-	op("BNZ", op_bnz),
-	op("BRA", op_bra),
-	op("BRS", op_brs),
-	op("CEQ", op_ceq),
-	op("CGE", op_cge),
-	op("CGT", op_cgt),
-	op("CLE", op_cle),
-	op("CLT", op_clt),
-	op("CNE", op_cne),
-	op("DEC", op_dec),
-	op("DIV", op_div),
-	op("DUP", op_dup),
-	op("HLT", op_hlt),
-	op("ICH", op_ich),
-	op("INC", op_inc),
-	op("INI", op_ini),
-	op("JAL", op_jal),
-	op("LDA", op_lda),
-	op("LDI", op_ldi),
-	op("MOD", op_mod),
-	op("MUL", op_mul),
-	op("NOT", op_not),
-	op("OAR", op_oar),
-	op("OCH", op_och),
-	op("OTI", op_oti),
-	op("OTS", op_ots),
-	op("RTN", op_rtn),
-	op("STA", op_sta),
-	op("SUB", op_sub),
-	op("XOR", op_xor)
+	op("ADD", op_add, ARG_NONE, 0),
+	op("AFA", op_afa, ARG_ADDRESS, 0),
+	op("AND", op_and, ARG_NONE, 0),
+	op("BAR", op_bar, ARG_NONE, 0),
+	op("BEZ", op_bez, ARG_LABEL, 0),
+	op("BLS", op_bls, ARG_NONE, 0),
+	op("BNZ", op_bnz, ARG_LABEL, 0),
+	op("BRA", op_bra, ARG_LABEL, 0),
+	op("BRS", op_brs, ARG_NONE, 0),
+	op("CAS", op_cas, ARG_ADDRESS, 0),
+	op("CEQ", op_ceq, ARG_NONE, 0),
+	op("CGE", op_cge, ARG_NONE, 0),
+	op("CGT", op_cgt, ARG_NONE, 0),
+	op("CLE", op_cle, ARG_NONE, 0),
+	op("CLT", op_clt, ARG_NONE, 0),
+	op("CNE", op_cne, ARG_NONE, 0),
+	op("DEC", op_dec, ARG_NONE, 0),
+	op("DIV", op_div, ARG_NONE, 0),
+	op("DRP", op_drp, ARG_NONE, 0),
+	op("DUP", op_dup, ARG_NONE, 1),
+	op("END", op_end, ARG_NONE, 0),
+	op("ENT", op_ent, ARG_NUMBER, 0),
+	op("FRK", op_frk, ARG_LABEL, 0),
+	op("HLT", op_hlt, ARG_NONE, 0),
+	op("ICH", op_ich, ARG_NONE, 1),
+	op("INC", op_inc, ARG_NONE, 0),
+	op("INI", op_ini, ARG_NONE, 1),
+	op("JAL", op_jal, ARG_LABEL, 1),
+	op("JNW", op_jnw, ARG_NONE, 0),
+	op("JON", op_jon, ARG_NONE, 0),
+	op("JTB", op_jtb, ARG_TABLE, 0),
+	op("LDA", op_lda, ARG_ADDRESS, 1),
+	op("LDI", op_ldi, ARG_NUMBER, 1),
+	op("LDL", op_ldl, ARG_NUMBER, 1),
+	op("LDX", op_ldx, ARG_NUMBER, 1),
+	op("MOD", op_mod, ARG_NONE, 0),
+	op("MUL", op_mul, ARG_NONE, 0),
+	op("NOT", op_not, ARG_NONE, 0),
+	op("OAR", op_oar, ARG_NONE, 0),
+	op("OCH", op_och, ARG_NONE, 0),
+	op("OTI", op_oti, ARG_NONE, 0),
+	op("OTS", op_ots, ARG_STRING, 0),
+	op("OVR", op_ovr, ARG_NONE, 1),
+	op("PIK", op_pik, ARG_NUMBER, 1),
+	op("ROL", op_rol, ARG_NUMBER, 1),
+	op("ROT", op_rot, ARG_NONE, 1),
+	op("RTN", op_rtn, ARG_NONE, 0),
+	op("SPN", op_spn, ARG_LABEL, 1),
+	op("STA", op_sta, ARG_ADDRESS, 0),
+	op("STL", op_stl, ARG_NUMBER, 0),
+	op("STX", op_stx, ARG_NUMBER, 0),
+	op("SUB", op_sub, ARG_NONE, 0),
+	op("SWP", op_swp, ARG_NONE, 1),
+	op("XOR", op_xor, ARG_NONE, 0),
+	op("YLD", op_yld, ARG_NONE, 0)
 };
 
-void load(vm_t *vm, FILE *in) {
+int opfind(char *code) {
+	int i;
 
-	char line[LINE_MAX];
-	int cap = LINE_MAX;
+	for (i = 0; i < NOPS; i++) {
+		if (memcmp(code, opcodes[i].code, 3) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* kind of operand insn takes */
+int oparg(insn_t *insn) {
+	return insn->op == -1 ? ARG_NONE : opcodes[insn->op].arg;
+}
+
+/* decode line lineno of chunk, appending to its instructions and labels */
+int decode(chunk_t *chunk, size_t lineno) {
+
+	char *line = chunk->lines[lineno];
+	size_t len, i;
+	symbol_t *sym;
+	insn_t *insn;
+	int table;
+
+	if (line[0] == '#') {
+		return 0; /* comment */
+	}
+
+	len = strlen(line);
+	/* an opcode takes 3 characters, don't look past the end of a shorter line */
+	table = len >= 11 && memcmp(line + 8, "TBL", 3) == 0;
+
+	/* it's a label, possibly followed by an opcode, or the name of a jump table */
+	if (line[0] != ' ' && line[0] != '\0') {
+		if (table) {
+			if (grow((void **) &chunk->tables, &chunk->tablecap, chunk->ntables, sizeof(symbol_t)) == -1) {
+				return -1;
+			}
+			sym = &chunk->tables[chunk->ntables++];
+			sym->pc = lineno;
+		} else {
+			if (grow((void **) &chunk->symbols, &chunk->symcap, chunk->nsyms, sizeof(symbol_t)) == -1) {
+				return -1;
+			}
+			sym = &chunk->symbols[chunk->nsyms++];
+			sym->pc = chunk->ncode;
+		}
+		for (i = 0; i < LBLLN - 1 && line[i] != ' ' && line[i] != '\0'; i++) {
+			sym->label[i] = line[i];
+		}
+		sym->label[i] = '\0';
+	}
+
+	/* TBL isn't an instruction, the loader resolves its labels */
+	if (table || len <= 8 || line[8] == ' ') {
+		return 0; /* no opcode */
+	}
 
-	memset(vm, '\0', sizeof(vm_t));
+	if (grow((void **) &chunk->code, &chunk->codecap, chunk->ncode, sizeof(insn_t)) == -1) {
+		return -1;
+	}
+	insn = &chunk->code[chunk->ncode++];
+	insn->op = len >= 11 ? opfind(line + 8) : -1;
+	insn->fn = insn->op == -1 ? op_bad : opcodes[insn->op].fn;
+	insn->line = lineno;
+	insn->target = NOLINE;
+	insn->arg = 0;
+	if (insn->op != -1 && (opcodes[insn->op].arg == ARG_NUMBER || opcodes[insn->op].arg == ARG_ADDRESS) && len > 12) {
+		insn->arg = atoi(line + 12);
+	}
+	/* checked once here so executing it needn't */
+	if (insn->op != -1 && opcodes[insn->op].arg == ARG_ADDRESS && (insn->arg < 0 || insn->arg >= MEMSZ)) {
+		insn->fn = op_bad_address;
+	}
 
-	while (fgets(line, cap, in) != NULL) {
+	return 0;
+}
 
-		chomp(line);
+/* zero the pages of memory written since the last reset */
+void memreset(mem_t *memory) {
+	size_t i;
 
-		/* it's a label */
-		if (line[0] != '#' && line[0] != ' ') {
-			symdef(&vm->symtab, line, vm->program.sp);
+	for (i = 0; i < MEMSZ / PAGESZ; i++) {
+		if (memory->dirty[i]) {
+			memset(&memory->cells[i * PAGESZ], '\0', PAGESZ * sizeof(cell_t));
+			memory->dirty[i] = 0;
 		}
-		/* record line for future reference */
-		strncpy(vm->program.lines[vm->program.sp], line, LNLEN);
-		vm->program.sp++;
 	}
 }
 
-void run(vm_t *vm) {
+/* prepare vm to execute program using memory as its main memory */
+void vm_init(vm_t *vm, program_t *program, mem_t *memory) {
+
+	size_t i;
+
+	vm->memory = memory;
+	vm->program = program;
+	for (i = 0; i < NTASKS; i++) {
+		vm->tasks[i].state = TASK_FREE;
+		vm->tasks[i].stack.sp = 0;
+		call_reset(&vm->tasks[i].call_stack);
+	}
+	vm->workers = NULL;
+	vm->team = NULL;
+	vm->insn = NULL;
+	vm->out = stdout;
+	memset(&vm->tally, '\0', sizeof(tally_t));
+	vm->tally.in = vm->in.total;
+	vm->pc = vm->task = 0;
+	vm->done = vm->yield = 0;
+}
+
+/* release what vm_init() and running allocated, not the vm itself */
+void vm_free(vm_t *vm) {
+	size_t i;
+
+	for (i = 0; i < NTASKS; i++) {
+		call_free(&vm->tasks[i].call_stack);
+	}
+}
+
+/* publish vm's stats to stats */
+void vm_stats(vm_t *vm, stats_t *stats) {
+	size_t i;
+
+	for (i = 0; i < NOPS && i < MAXOPS; i++) {
+		memcpy(stats->names[i], opcodes[i].code, 4);
+	}
+	stats->nops = (uint32_t) i;
+	vm->stats = stats;
+}
 
-	size_t begin;
+/* the implementation an instrumented instruction wraps */
+#define inner(vm) ((vm)->program->inner[(vm)->insn - (vm)->program->code])
 
-	/* start a MAIN */
-	begin = symfind(&vm->symtab, "MAIN"); /* move to const.h */
-	/* if not found, start at line 0 */
-	if (begin == LNMAX + 1) {
-		begin = 0;
+static void profiled(vm_t *vm) {
+	inner(vm)(vm);
+	profile_record(vm);
+}
+
+/* record a profile of program's instructions from now on, -1 if out of memory */
+/* instead of testing for it on every step of every program */
+int vm_instrument(program_t *program) {
+	size_t i;
+
+	if (program->inner == NULL) {
+		program->inner = calloc(program->ncode + 1, sizeof(*program->inner));
+		if (program->inner == NULL) {
+			return -1;
+		}
 	}
 
-	for (vm->pc = begin; vm->pc < vm->program.sp && !vm->done && !feof(stdin) && !ferror(stdin); vm->pc++) {
-		size_t i, run;
-		if (vm->program.lines[vm->pc][0] != ' ') {
-			continue; /* label or comment */
+	for (i = 0; i < program->ncode; i++) {
+		insn_t *insn = &program->code[i];
+		if (insn->op < 0 || program->inner[i] != NULL) {
+			continue; /* OP_BAD stops the vm anyway */
 		}
-		/* opcode */
-		for (run = i = 0; i < NOPS; i++) {
-			/* find op code and execute it */
-			if (memcmp(vm->program.lines[vm->pc] + 8, opcodes[i].code, 3) == 0) {
-				opcodes[i].fn(vm);
-				run = 1;
-				break;
+		program->inner[i] = insn->fn;
+		insn->fn = profiled;
+	}
+
+	return 0;
+}
+
+/* the execution loop */
+static void loop(vm_t *vm) {
+	while (!vm->done) {
+		if (vm->pc >= vm->program->ncode) {
+			task_end(vm); /* ran off the end */
+		} else {
+			vm->insn = &vm->program->code[vm->pc++];
+			vm->insn->fn(vm);
+		}
+		if (vm->yield) {
+			task_switch(vm);
+		}
+	}
+}
+
+/* the execution loop, counting what it does for --stats */
+static void loop_counted(vm_t *vm) {
+	tally_t *tally = &vm->tally;
+	insn_t *insn;
+
+	while (!vm->done) {
+		if (vm->pc >= vm->program->ncode) {
+			task_end(vm); /* ran off the end */
+		} else {
+			insn = vm->insn = &vm->program->code[vm->pc++];
+			insn->fn(vm);
+
+			tally->insns++;
+			if (insn->op >= 0) {
+				tally->ops[insn->op]++;
+				if (opcodes[insn->op].deepens) {
+					if (vm->stack->sp > tally->stack_peak) {
+						tally->stack_peak = vm->stack->sp;
+					}
+					if (vm->call_stack->sp > tally->call_peak) {
+						tally->call_peak = vm->call_stack->sp;
+					}
+				}
+			}
+			if ((tally->insns & (STATBATCH - 1)) == 0) {
+				stats_flush(vm);
 			}
 		}
-		if (run == 0) {
-			fprintf(stderr, "ERROR: BAD OP CODE (LINE %lu)\n", vm->pc);
-			return;
+		if (vm->yield) {
+			task_switch(vm);
 		}
 	}
+}
+
+/* run task 0 from pc until every task ends or one halts */
+void execute(vm_t *vm, size_t pc) {
+
+	vm->tasks[0].pc = pc;
+	task_enter(vm, 0);
+
+	/* pick once, so only --stats pays for counting */
+	if (vm->stats != NULL) {
+		loop_counted(vm);
+	} else {
+		loop(vm);
+	}
+
+	/* don't leave workers running behind our back */
+	par_join(vm);
 
+	if (vm->stats != NULL) {
+		stats_flush(vm);
+	}
+}
+
+void run(vm_t *vm) {
+	input_init(&vm->in, fileno(stdin));
+	execute(vm, vm->program->entry);
 }
 
+/* run the program once per record of standard input, a line or size bytes */
+void run_records(vm_t *vm, size_t size) {
+	char record[INBUFSZ + 1];
+	input_t src;
+	size_t len, n;
+	int c;
+
+	input_init(&src, fileno(stdin));
+
+	for (n = 1; ; n++) {
+		if (size == 0) {
+			if (input_gets(&src, record, sizeof(record)) == NULL) {
+				break;
+			}
+			len = strlen(record);
+			/* a line that doesn't fit the vm's input is skipped, not split */
+			if (len == INBUFSZ && record[len - 1] != '\n' && (c = input_getc(&src)) != EOF) {
+				while (c != '\n' && c != EOF) {
+					c = input_getc(&src);
+				}
+				fprintf(stderr, "ERROR: RECORD TOO LONG (RECORD %lu)\n", n);
+				continue;
+			}
+		} else if ((len = input_read(&src, record, size)) == 0) {
+			break;
+		}
+
+		/* only undo what the last record did */
+		memreset(vm->memory);
+		vm_init(vm, vm->program, vm->memory);
+		input_record(&vm->in, record, len);
+		execute(vm, vm->program->entry);
+	}
+}
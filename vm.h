@@ -23,12 +23,22 @@ SOFTWARE.
 #ifndef __VM_H
 #define __VM_H
 
+#include <stddef.h>
 #include <stdio.h>
 
 #include "const.h"
 #include "types.h"
 
-void load(vm_t *vm, FILE *in);
+int opfind(char *code);
+int oparg(insn_t *insn);
+int decode(chunk_t *chunk, size_t lineno);
+void memreset(mem_t *memory);
+void vm_init(vm_t *vm, program_t *program, mem_t *memory);
+void vm_free(vm_t *vm);
+void vm_stats(vm_t *vm, stats_t *stats);
+int vm_instrument(program_t *program);
+void execute(vm_t *vm, size_t pc);
 void run(vm_t *vm);
+void run_records(vm_t *vm, size_t size);
 
 #endif